@@ -0,0 +1,72 @@
+/* see LICENSE file for copyright and license information. */
+
+/* config for make bench, every function that only reads files
+ * runs against the fixture tree in bench/root */
+
+#define UNKNOWN_STR          "n/a"
+#define COMMAND_TIMEOUT      5000
+#define NET_SMOOTHING        0
+#define BATT_WINDOW          300000
+#define DISK_TOTAL_REFRESH   600000
+#define DISK_AVAIL           0
+#define DISK_TIMEOUT         200
+#define DISK_STALE_STR       "?"
+#define HIST_SAMPLES         60
+#define HIST_WIDTH           20
+#define HIST_BARS            "▁▂▃▄▅▆▇█"
+#define WORKERS              2
+#define ASYNC_WAIT           50
+
+#define VOL_MUTE_STR         "muted"
+#define VOL_ZERO_STR         "0%%"
+#define VOL_STR              "%d%%"
+
+#define BATT_CHARGING_STR    "+"
+#define BATT_DISCHARGING_STR "-"
+#define BATT_FULL_STR        "="
+#define BATT_UNKNOWN_STR     "?"
+
+#define STATUS_FORMAT ""
+
+#define STATUS_CONTENT \
+    /* function             argument                                interval */\
+    { battery_perc,         "BAT0",                                 0 },\
+    { battery_state,        "BAT0",                                 0 },\
+    { battery_time,         "BAT0",                                 0 },\
+    { battery_perc,         "BAT0+BAT1",                            0 },\
+    { battery_time,         "BAT0+BAT1",                            0 },\
+    { battery_watts,        "BAT0",                                 0 },\
+    { battery_perc_smapi,   "BAT0",                                 0 },\
+    { battery_state_smapi,  "BAT0",                                 0 },\
+    { battery_time_smapi,   "BAT0",                                 0 },\
+    { cpu_core,             "3",                                    0 },\
+    { cpu_freq,             NULL,                                   0 },\
+    { cpu_iowait,           NULL,                                   0 },\
+    { cpu_max,              NULL,                                   0 },\
+    { cpu_perc,             NULL,                                   0 },\
+    { cpu_steal,            NULL,                                   0 },\
+    { datetime,             "%x %X",                                0 },\
+    { disk_free,            "/",                                    0 },\
+    { disk_io,              "nvme0n1",                              0 },\
+    { disk_iops,            "nvme0n1",                              0 },\
+    { disk_lat,             "nvme0n1",                              0 },\
+    { disk_perc,            "/",                                    0 },\
+    { disk_read,            "nvme0n1",                              0 },\
+    { disk_util,            "nvme0n1",                              0 },\
+    { entropy,              NULL,                                   0 },\
+    { fan_ibm,              NULL,                                   0 },\
+    { hist_spark,           "cpu",                                  0 },\
+    { hist_stats,           "rx eth0",                              0 },\
+    { load_avg,             NULL,                                   0 },\
+    { net_down,             "eth0",                                 0 },\
+    { net_down,             "all",                                  0 },\
+    { net_drops,            "wlp3s0",                               0 },\
+    { net_pkts,             "eth0",                                 0 },\
+    { net_up,               "eth0",                                 0 },\
+    { ram_free,             NULL,                                   0 },\
+    { ram_perc,             NULL,                                   0 },\
+    { ram_used,             NULL,                                   0 },\
+    { swap_perc,            NULL,                                   0 },\
+    { temp,                 "/sys/class/hwmon/hwmon0/temp1_input",  0 },\
+    { uptime,               NULL,                                   0 },\
+    { zswap_used,           NULL,                                   0 }
@@ -3,10 +3,50 @@
 /* text to show if no value can be retrieved */
 #define UNKNOWN_STR          "n/a"
 
+/* time in ms a run_command may take before it is killed,
+ * its last output keeps showing meanwhile */
+#define COMMAND_TIMEOUT      5000
+
+/* time constant in ms to smooth net_up/net_down rates over,
+ * 0 shows the plain rate since the previous sample */
+#define NET_SMOOTHING        0
+
+/* time in ms battery_time and battery_watts average the drain over,
+ * longer is steadier but slower to follow a change in load */
+#define BATT_WINDOW          300000
+
+/* time in ms disk_total keeps its value before asking again, remounts
+ * are picked up right away regardless */
+#define DISK_TOTAL_REFRESH   600000
+
+/* 1 counts free space as only what non-root users can write, like df,
+ * 0 includes the blocks reserved for root */
+#define DISK_AVAIL           0
+
+/* time in ms to wait for a mount to answer before showing its last
+ * value followed by DISK_STALE_STR, one that hangs is not asked again
+ * until it answers */
+#define DISK_TIMEOUT         200
+#define DISK_STALE_STR       "?"
+
+/* hist_* keep the last HIST_SAMPLES samples of a metric, hist_spark
+ * draws the last HIST_WIDTH of them with HIST_BARS, lowest first */
+#define HIST_SAMPLES         60
+#define HIST_WIDTH           20
+#define HIST_BARS            "▁▂▃▄▅▆▇█"
+
+/* entries with an ASYNC() interval run on up to WORKERS threads, so a
+ * slow sensor or ioctl can't hold up the status, it waits at most
+ * ASYNC_WAIT ms for them before showing their previous value */
+#define WORKERS              2
+#define ASYNC_WAIT           50
+
 /* this is needed to enable anything pulse */
 #define PULSE
-#define SINK_INDEX 0
-#define SOURCE_INDEX 1
+/* sink and source to show, the first one whose description contains
+ * this, an empty string follows the first one pulse lists */
+#define SINK_MATCH ""
+#define SOURCE_MATCH ""
 #define PULSE_HEADPHONE_STR  "alsa_output.pci-0000_00_1b.0.analog-stereo"
 #define PULSE_SPEAKER_STR    "alsa_output.pci-0000_00_1b.0.analog-surround-40"
 #define PULSE_HDMI_STR       "alsa_output.pci-0000_00_1b.0.hdmi-stereo"
@@ -27,32 +67,65 @@
 #define BATT_UNKNOWN_STR     "?"
 
 /* available functions
-- battery_perc [argument: battery name]         : battery percentage
+- battery_perc [argument: battery name(s)]      : battery percentage, several batteries
+                                                can be combined like "BAT0+BAT1"
 - battery_perc_smapi [argument: battery name]   : battery percentage, uses smapi 
-- battery_state [argument: battery name]        : battery charging state
+- battery_state [argument: battery name(s)]     : battery charging state
 - battery_state_smapi [argument: battery name]  : battery charging state, uses smapi 
+- battery_time [argument: battery name(s)]      : time till full/empty
+- battery_watts [argument: battery name(s)]     : average power draw in watts
 - battery_time_smapi [argument: battery name]   : time till full/empty, uses smapi 
+- cpu_core [argument: cpu number]               : usage of a single cpu core in percent
 - cpu_freq [argument: none]                     : cpu frequency in MHz 
+- cpu_iowait [argument: none]                   : time spent waiting on io in percent
+- cpu_max [argument: none]                      : usage of the busiest cpu core in percent
 - cpu_perc [argument: none]                     : cpu usage in percent 
+- cpu_steal [argument: none]                    : time stolen by the hypervisor in percent
 - datetime [argument: format]                   : date/time (for help 'man strftime')
 - disk_free [argument: mountpoint]              : free disk space in GB 
-- disk_io [argument: none]                      : active number of I/O operations 
+- disk_fullest [argument: mountpoints]          : fullest of a space separated list of
+                                                mountpoints and globs like "/net/nfs?",
+                                                with its usage in percent
+- disk_io [argument: block device]              : active number of I/O operations
+- disk_iops [argument: block device]            : read/write operations per second
+- disk_lat [argument: block device]             : average time an I/O operation took in ms
 - disk_perc [argument: mountpoint]              : disk usage in percent 
+- disk_read [argument: block device]            : bytes read per second
 - disk_total [argument: mountpoint]             : total disk space in GB 
 - disk_used [argument: mountpoint]              : used disk space in GB 
+- disk_util [argument: block device]            : percentage of time the device was busy
+- disk_write [argument: block device]           : bytes written per second
 - entropy [argument: none]                      : available entropy 
 - fan_ibm [argument: none]                      : fan speed in rpm 
 - gid [argument: none]                          : gid of current user 
+- hist_spark [argument: metric]                 : sparkline of a metric's recent history,
+                                                one of "cpu", "ram", "swap", "io <device>",
+                                                "rx <interface>" or "tx <interface>",
+                                                sampled at the entry's interval
+- hist_stats [argument: metric]                 : min/avg/max of a metric's history
 - hostname [argument: none]                     : machine hostname
-- ip [argument: interface]                      : ip address 
+- ip [argument: interface]                      : ipv4 address, follows address changes, use
+                                                "default" for the default route's interface
+- ip6 [argument: interface]                     : ipv6 address, same as ip
 - load_avg [argument: none]                     : load average 
-- net_down [argument: network card interface]   : current download in B/s|KB/s|MB/s 
-- net_up [argument: network card interface]     : current upload in B/s|KB/s|MB/s 
+- net_down [argument: network card interface]   : current download in B/s|KB/s|MB/s, use
+                                                "all" for every interface but loopback
+- net_drops [argument: network card interface]  : dropped packets received/sent, same as net_down
+- net_errs [argument: network card interface]   : packet errors received/sent, same as net_down
+- net_pkts [argument: network card interface]   : packets per second received/sent, same as net_down
+- net_up [argument: network card interface]     : current upload in B/s|KB/s|MB/s, same as net_down
+- ram_dirty [argument: none]                    : dirty ram waiting to be written in GB
 - ram_free [argument: none]                     : free ram in GB 
 - ram_perc [argument: none]                     : ram usage in percent 
+- ram_shmem [argument: none]                    : shared memory (tmpfs etc) in GB
+- ram_sreclaimable [argument: none]             : reclaimable slab memory in GB
 - ram_total [argument: none]                    : total ram in GB 
 - ram_used [argument: none]                     : used ram in GB 
-- run_command [argument: command]               : run custom shell command 
+- ram_writeback [argument: none]                : ram actively being written back in GB
+- run_command [argument: command]               : run custom shell command in the background,
+                                                shows the first line of its output
+- run_stream [argument: command]                : long running shell command, every new line
+                                                of its output is shown as it comes in
 - swap_free [argument: none]                    : free swap in GB 
 - swap_perc [argument: none]                    : swap usage in percent 
 - swap_total [argument: none]                   : total swap in GB 
@@ -61,19 +134,44 @@
 - uid [argument: none]                          : uid of current user 
 - uptime [argument: none]                       : uptime 
 - username [argument: none]                     : username of current user 
-- vol_perc_alsa [argument: soundcard]           : alsa volume and mute status in percent 
+- vol_perc_alsa [argument: soundcard]           : alsa volume and mute status in percent, updated
+                                                on alsa events, the interval only matters for
+                                                retrying a missing card
 - vol_perc_pulse [argument: none]               : pulse volume and mute status in percent 
 - micvol_perc_pulse [argument: none]            : pulse mic volume and mute status in percent
 - pulse_profile [argument: none]                : profile of pulse volume being displayed, 
                                                 only while vol_perc_pulse is in use
 - pulse_profile_icon [argument: none]           : same as pulse_profile but use predefined
                                                 icons instead of full name| see defs above
-- wifi_essid [argument: wifi card interface]    : wifi essid 
-- wifi_perc [argument: none]                    : wifi signal in percent */
+- wifi_bitrate [argument: wifi card interface]  : wifi tx/rx bitrate in Mbit/s
+- wifi_dbm [argument: wifi card interface]      : wifi signal in dBm
+- wifi_essid [argument: wifi card interface]    : wifi essid, updated on connect and
+                                                disconnect events
+- wifi_freq [argument: wifi card interface]     : wifi frequency in MHz, updated on
+                                                connect and disconnect events
+- wifi_perc [argument: wifi card interface]     : wifi signal in percent
+- zswap_stored [argument: none]                 : uncompressed size of data in zswap in GB
+- zswap_used [argument: none]                   : compressed size of the zswap pool in GB */
 
 #define STATUS_FORMAT "vol: %s[%s] bat: %s[%s] wifi: %s[%s] | %s"
+
+/* every %s in STATUS_FORMAT is filled in by the matching STATUS_CONTENT
+ * entry, each is sampled again once its interval in ms has passed,
+ * an interval of 0 samples the entry only once at startup, pulse
+ * functions are updated by pulse events on their own and can use 0,
+ * battery_* are also updated on power supply events,
+ * wrap the interval in ASYNC() to sample an entry that can block, like
+ * temp on a slow sensor, on a worker thread, only these allow it:
+ * battery_*_smapi, cpu_freq, datetime, disk_free, disk_fullest,
+ * disk_perc, disk_total, disk_used, entropy, fan_ibm, gid, hostname,
+ * load_avg, temp, temp_workaround, uid and uptime, any other stays on
+ * the main thread with a warning */
 #define STATUS_CONTENT \
-    pulse_profile(), vol_perc_pulse(), \
-    battery_perc("BAT0"), battery_state("BAT0"), \
-    wifi_essid("wlp3s0"), wifi_perc(),\
-    datetime("%x %X")
+    /* function         argument        interval */\
+    { pulse_profile,    NULL,           0 },\
+    { vol_perc_pulse,   NULL,           0 },\
+    { battery_perc,     "BAT0",         30000 },\
+    { battery_state,    "BAT0",         5000 },\
+    { wifi_essid,       "wlp3s0",       10000 },\
+    { wifi_perc,        "wlp3s0",       5000 },\
+    { datetime,         "%x %X",        1000 }
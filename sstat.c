@@ -1,1058 +1,4749 @@
 /* see LICENSE file for copyright and license information. */
 
 #include <alsa/asoundlib.h>
+#include <arpa/inet.h>
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <ifaddrs.h>
+#include <fnmatch.h>
 #include <limits.h>
-#include <linux/wireless.h>
-#include <netdb.h>
+#include <linux/genetlink.h>
+#include <net/if.h>
+#include <linux/nl80211.h>
+#include <linux/rtnetlink.h>
+#include <math.h>
 #include <pulse/pulseaudio.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <sys/sysinfo.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include <X11/Xlib.h>
 
+#define LEN(x) (sizeof(x) / sizeof((x)[0]))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
 typedef enum { STDOUT, XROOT } output;
 
-static char *battery_perc(const char *bat);
-static char *battery_perc_smapi(const char *bat);
-static char *battery_state(const char *bat);
-static char *battery_time(const char *bat);
-static char *battery_state_smapi(const char *bat);
-static char *battery_time_smapi(const char *bat);
-static char *cpu_freq(void);
-static char *cpu_perc(long double ps_old[4]);
-static char *datetime(const char *fmt);
-static char *disk_free(const char *mnt);
-static char *disk_io(void);
-static char *disk_perc(const char *mnt);
-static char *disk_total(const char *mnt);
-static char *disk_used(const char *mnt);
-static char *entropy(void);
-static char *fan_ibm(void);
-static char *gid(void);
-static char *hostname(void);
-static char *ip(const char *iface);
-static char *load_avg(void);
-static char *net_down(double *rx_old, const char *iface);
-static char *net_up(double *tx_old, const char *iface);
-static char *ram_free(void);
-static char *ram_perc(void);
-static char *ram_total(void);
-static char *ram_used(void);
-static char *run_command(const char *cmd);
-static char *swap_free(void);
-static char *swap_perc(void);
-static char *swap_total(void);
-static char *swap_used(void);
-static char *temp(const char *file);
-static char *temp_workaround(const char *file, const char *file_);
-static char *uid(void);
-static char *uptime(void);
-static char *username(void);
-static char *vol_perc_alsa(const char *card);
-static char *wifi_essid(const char *iface);
-static char *wifi_perc(void);
-static void sighandler(const int signo);
+/* a file descriptor the main loop waits on */
+typedef struct Watch Watch;
+struct Watch {
+    int fd;
+    void (*cb)(Watch *w, uint32_t events);
+};
+static int epfd = -1; /* of the main loop, there is none under -b */
+
+typedef struct {
+    char *(*func)(const char *arg, char *out, size_t outlen);
+    const char *arg;
+    unsigned int interval; /* ms, 0 samples only once */
+} Module;
+/* an interval wrapped in ASYNC() is sampled on a worker thread */
+#define ASYNC_BIT (1U << 31)
+#define ASYNC(ms) ((ms) | ASYNC_BIT)
+#define INTERVAL(i) (modules[i].interval & ~ASYNC_BIT)
+
+static char *battery_perc(const char *bat, char *out, size_t outlen);
+static char *battery_perc_smapi(const char *bat, char *out, size_t outlen);
+static char *battery_state(const char *bat, char *out, size_t outlen);
+static char *battery_time(const char *bat, char *out, size_t outlen);
+static char *battery_watts(const char *bat, char *out, size_t outlen);
+static char *battery_state_smapi(const char *bat, char *out, size_t outlen);
+static char *battery_time_smapi(const char *bat, char *out, size_t outlen);
+static char *cpu_core(const char *core, char *out, size_t outlen);
+static char *cpu_freq(const char *unused, char *out, size_t outlen);
+static char *cpu_iowait(const char *unused, char *out, size_t outlen);
+static char *cpu_max(const char *unused, char *out, size_t outlen);
+static char *cpu_perc(const char *unused, char *out, size_t outlen);
+static char *cpu_steal(const char *unused, char *out, size_t outlen);
+static char *datetime(const char *fmt, char *out, size_t outlen);
+static char *disk_free(const char *mnt, char *out, size_t outlen);
+static char *disk_fullest(const char *mnts, char *out, size_t outlen);
+static char *disk_io(const char *dev, char *out, size_t outlen);
+static char *disk_iops(const char *dev, char *out, size_t outlen);
+static char *disk_lat(const char *dev, char *out, size_t outlen);
+static char *disk_perc(const char *mnt, char *out, size_t outlen);
+static char *disk_read(const char *dev, char *out, size_t outlen);
+static char *disk_total(const char *mnt, char *out, size_t outlen);
+static char *disk_used(const char *mnt, char *out, size_t outlen);
+static char *disk_util(const char *dev, char *out, size_t outlen);
+static char *disk_write(const char *dev, char *out, size_t outlen);
+static char *entropy(const char *unused, char *out, size_t outlen);
+static char *fan_ibm(const char *unused, char *out, size_t outlen);
+static char *gid(const char *unused, char *out, size_t outlen);
+static char *hist_spark(const char *metric, char *out, size_t outlen);
+static char *hist_stats(const char *metric, char *out, size_t outlen);
+static char *hostname(const char *unused, char *out, size_t outlen);
+static char *ip(const char *iface, char *out, size_t outlen);
+static char *ip6(const char *iface, char *out, size_t outlen);
+static char *load_avg(const char *unused, char *out, size_t outlen);
+static char *net_down(const char *iface, char *out, size_t outlen);
+static char *net_drops(const char *iface, char *out, size_t outlen);
+static char *net_errs(const char *iface, char *out, size_t outlen);
+static char *net_pkts(const char *iface, char *out, size_t outlen);
+static char *net_up(const char *iface, char *out, size_t outlen);
+static char *ram_dirty(const char *unused, char *out, size_t outlen);
+static char *ram_free(const char *unused, char *out, size_t outlen);
+static char *ram_perc(const char *unused, char *out, size_t outlen);
+static char *ram_shmem(const char *unused, char *out, size_t outlen);
+static char *ram_sreclaimable(const char *unused, char *out, size_t outlen);
+static char *ram_total(const char *unused, char *out, size_t outlen);
+static char *ram_used(const char *unused, char *out, size_t outlen);
+static char *ram_writeback(const char *unused, char *out, size_t outlen);
+static char *run_command(const char *cmd, char *out, size_t outlen);
+static char *run_stream(const char *cmd, char *out, size_t outlen);
+static char *swap_free(const char *unused, char *out, size_t outlen);
+static char *swap_perc(const char *unused, char *out, size_t outlen);
+static char *swap_total(const char *unused, char *out, size_t outlen);
+static char *swap_used(const char *unused, char *out, size_t outlen);
+static char *temp(const char *file, char *out, size_t outlen);
+static char *temp_workaround(const char *files, char *out, size_t outlen);
+static char *uid(const char *unused, char *out, size_t outlen);
+static char *uptime(const char *unused, char *out, size_t outlen);
+static char *username(const char *unused, char *out, size_t outlen);
+static char *vol_perc_alsa(const char *card, char *out, size_t outlen);
+static char *wifi_bitrate(const char *iface, char *out, size_t outlen);
+static char *wifi_dbm(const char *iface, char *out, size_t outlen);
+static char *wifi_essid(const char *iface, char *out, size_t outlen);
+static char *wifi_freq(const char *iface, char *out, size_t outlen);
+static char *wifi_perc(const char *iface, char *out, size_t outlen);
+static char *zswap_stored(const char *unused, char *out, size_t outlen);
+static char *zswap_used(const char *unused, char *out, size_t outlen);
+static ssize_t readfile(const char *path, char *buf, size_t len);
 static void update_status(output dest, const char *str);
-
-#include "config.h"
+static unsigned long now_ms(void);
+static void prof_dump(void);
+static void pool_init(void);
+static void pool_wait(unsigned long deadline);
+static void tmpl_compile(void);
+static void bench(unsigned long n);
+static void schedule(unsigned long now);
+static int render(char *buf, size_t len);
+static void slots_set(char *(*func)(const char *, char *, size_t), const char *arg, const char *val);
+static void wake(char *(*func)(const char *, char *, size_t));
+static int watch_add(Watch *w, uint32_t events);
+static int watch_mod(Watch *w, uint32_t events);
+static void watch_del(Watch *w);
+
+#ifndef CONFIG
+#define CONFIG "config.h"
+#endif
+#include CONFIG
 
 static unsigned short int done;
+static _Atomic unsigned long cycle = 1; /* 0 marks per-cycle caches as never filled */
 static Display *display;
 
 /* pulse garbage */
 #ifdef PULSE
-static char *pulse_profile(void);
-static char *pulse_profile_icon(void);
-static char *vol_perc_pulse(void);
-static char *micvol_perc_pulse(void);
+static char *pulse_profile(const char *unused, char *out, size_t outlen);
+static char *pulse_profile_icon(const char *unused, char *out, size_t outlen);
+static char *vol_perc_pulse(const char *unused, char *out, size_t outlen);
+static char *micvol_perc_pulse(const char *unused, char *out, size_t outlen);
 static void pulse_context_state_cb(pa_context *c, void *userdata);
 static void pulse_sink_info_cb(pa_context *c, const pa_sink_info *sink_info, int eol, void *userdata);
 static void pulse_source_info_cb(pa_context *c, const pa_source_info *source_info, int eol, void *userdata);
 static void pulse_volume_change_cb(pa_context *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata);
+static void pulse_wake(void);
+static pa_mainloop_api pulse_api;
+static pa_context *pulse_ctx; /* NULL once the connection is gone */
 
 static char pulse_vol_str[80] = UNKNOWN_STR;
 static char pulse_micvol_str[80] = UNKNOWN_STR;
 static  char pulse_profile_str[80] = UNKNOWN_STR;
 #endif
 
-#define RETURN_FORMAT(len, format, ...)\
-    static char ret_str[len];\
-    sprintf(ret_str, format, ##__VA_ARGS__);\
-    return ret_str;
-
-static char *
-battery_perc(const char *bat)
+/* last sampled value of every STATUS_CONTENT entry,
+ * plus a min-heap ordering them by their next deadline */
+#define VALUE_MAX 256
+
+static const Module modules[] = { STATUS_CONTENT };
+static struct {
+    char val[VALUE_MAX];
+    unsigned long deadline;
+    int dirty; /* changed since the last render */
+} slots[LEN(modules)];
+static size_t heap[LEN(modules)];
+static char arena[LEN(modules)][VALUE_MAX]; /* what functions write into */
+#define STATUS_MAX (sizeof(STATUS_FORMAT) + LEN(slots) * VALUE_MAX)
+
+/* every function writes its value into the buffer it's handed,
+ * anything longer than outlen is cut off */
+#define RETURN_FORMAT(format, ...)\
+    snprintf(out, outlen, format, ##__VA_ARGS__);\
+    return out;
+
+/* procfs/sysfs files are opened once and kept open,
+ * rereading them from offset 0 gets fresh values */
+#define READERS_MAX 64
+
+static struct {
+    char *path;
+    int fd;
+} readers[READERS_MAX];
+static int readers_len;
+static _Thread_local int readers_off; /* set on worker threads */
+
+/* prefix for every procfs/sysfs path and mountpoint, set with -r or
+ * SSTAT_ROOT to read from a fixture tree instead of the real system */
+static const char *root = "";
+
+static const char *
+rooted(const char *path)
 {
-    char path[50];
-    int perc;
-    FILE *fp;
+    static _Thread_local char buf[PATH_MAX];
 
-    sprintf(path, "/sys/class/power_supply/%s/capacity", bat);
-    fp = fopen(path, "r");
-    if (fp == NULL) {
-        warn("Failed to open file %s", path);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (!*root) {
+        return path;
     }
-    fscanf(fp, "%i", &perc);
-    fclose(fp);
+    snprintf(buf, sizeof(buf), "%s%s", root, path);
 
-    RETURN_FORMAT(5, "%d%%", perc)
+    return buf;
 }
 
-static char *
-battery_state(const char *bat)
+static int
+reader_open(const char *path)
 {
-    char path[40];
-    char state[12];
-    FILE *fp;
+    return open(rooted(path), O_RDONLY | O_CLOEXEC);
+}
 
-    sprintf(path, "/sys/class/power_supply/%s/status", bat);
-    fp = fopen(path, "r");
-    if (fp == NULL) {
-        warn("Failed to open file %s", path);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+static ssize_t
+reader_pread(int fd, char *buf, size_t len)
+{
+    ssize_t n;
+    size_t want, off = 0;
+
+    /* procfs and sysfs hand out all they have in one go, so a short
+     * read is the end of the file and saves asking again for the eof */
+    while (off < len - 1) {
+        want = len - 1 - off;
+        if ((n = pread(fd, buf + off, want, off)) < 0) {
+            return -1;
+        }
+        off += n;
+        if ((size_t)n < want) {
+            break;
+        }
     }
-    fscanf(fp, "%11s", state);
-    fclose(fp);
+    buf[off] = '\0';
 
-    if (!strcmp(state, "Charging")) {
-        RETURN_FORMAT(20, BATT_CHARGING_STR);
-    } else if (!strcmp(state, "Discharging")) {
-        RETURN_FORMAT(20, BATT_DISCHARGING_STR);
-    } else if (!strcmp(state, "Full")) {
-        RETURN_FORMAT(20, BATT_FULL_STR);
-    } else {
-        RETURN_FORMAT(20, BATT_UNKNOWN_STR);
-    }
+    return off;
 }
 
-static char *
-battery_time(const char *bat)
+static ssize_t
+readfile(const char *path, char *buf, size_t len)
 {
-    char path[50];
-    int energy;
-    int power;
-    FILE *fp;
+    int i, fd;
+    ssize_t n;
 
-    sprintf(path, "/sys/class/power_supply/%s/energy_now", bat);
-    fp = fopen(path, "r");
-    if (fp == NULL) {
-        warn("Failed to open file %s", path);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (readers_off) {
+        /* the table belongs to the main thread */
+        if ((fd = reader_open(path)) < 0) {
+            return -1;
+        }
+        n = reader_pread(fd, buf, len);
+        close(fd);
+        return n;
     }
-    fscanf(fp, "%d", &energy);
-    fclose(fp);
 
-    sprintf(path, "/sys/class/power_supply/%s/power_now", bat);
-    fp = fopen(path, "r");
-    if (fp == NULL) {
-        warn("Failed to open file %s", path);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    for (i = 0; i < readers_len; i++) {
+        if (!strcmp(readers[i].path, path)) {
+            break;
+        }
+    }
+
+    if (i == readers_len) {
+        if ((fd = reader_open(path)) < 0) {
+            return -1;
+        }
+        if (readers_len == READERS_MAX) {
+            /* table full, fall back to a one-off read */
+            n = reader_pread(fd, buf, len);
+            close(fd);
+            return n;
+        }
+        readers[i].path = strdup(path);
+        readers[i].fd = fd;
+        readers_len++;
     }
-    fscanf(fp, "%d", &power);
-    fclose(fp);
 
-    if (!power || !energy) {
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    n = reader_pread(readers[i].fd, buf, len);
+    if (n < 0 && (errno == ENODEV || errno == ESTALE)) {
+        /* device went away (battery unplugged etc), reopen */
+        close(readers[i].fd);
+        if ((readers[i].fd = reader_open(path)) >= 0) {
+            n = reader_pread(readers[i].fd, buf, len);
+        }
+    }
+    if (readers[i].fd < 0 || n < 0) {
+        /* drop the entry so the next cycle tries opening again */
+        if (readers[i].fd >= 0) {
+            close(readers[i].fd);
+        }
+        free(readers[i].path);
+        readers[i] = readers[--readers_len];
+        return -1;
     }
 
-    int hours = energy/power;
-    int minutes = (((double)energy/power)-hours)*60;
-    RETURN_FORMAT(20, "%02d:%02d", hours, minutes);
+    return n;
 }
 
-static char *
-battery_perc_smapi(const char *bat)
+/* for tables that outgrow any fixed buffer, *buf is allocated on first
+ * use and doubled until the whole file fits */
+static ssize_t
+readfile_grow(const char *path, char **buf, size_t *size)
 {
-    char path[60];
-    int perc;
-    FILE *fp;
+    char *tmp;
+    ssize_t n;
 
-    sprintf(path, "/sys/devices/platform/smapi/%s/remaining_percent", bat);
-    fp = fopen(path, "r");
-    if (fp == NULL) {
-        warn("Failed to open file %s", path);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    for (;;) {
+        if (!*buf && !(*buf = malloc(*size))) {
+            return -1;
+        }
+        if ((n = readfile(path, *buf, *size)) < 0 || (size_t)n < *size - 1) {
+            return n;
+        }
+        if (!(tmp = realloc(*buf, *size * 2))) {
+            warn("Failed to allocate memory, %s is cut short", path);
+            return n;
+        }
+        *buf = tmp;
+        *size *= 2;
     }
-    fscanf(fp, "%i", &perc);
-    fclose(fp);
-
-    RETURN_FORMAT(5, "%d%%", perc);
 }
 
-static char *
-battery_state_smapi(const char *bat)
+/* /proc/meminfo is parsed once per cycle into this snapshot,
+ * shared by all ram_* and swap_* functions, values are in kB */
+static struct meminfo {
+    unsigned long cycle;
+    long total, free, available, buffers, cached, swapcached;
+    long swaptotal, swapfree, dirty, writeback, shmem, sreclaimable;
+    long zswap, zswapped;
+} meminfo;
+
+static const struct {
+    const char *key;
+    size_t off;
+} meminfo_keys[] = {
+    { "MemTotal",     offsetof(struct meminfo, total) },
+    { "MemFree",      offsetof(struct meminfo, free) },
+    { "MemAvailable", offsetof(struct meminfo, available) },
+    { "Buffers",      offsetof(struct meminfo, buffers) },
+    { "Cached",       offsetof(struct meminfo, cached) },
+    { "SwapCached",   offsetof(struct meminfo, swapcached) },
+    { "SwapTotal",    offsetof(struct meminfo, swaptotal) },
+    { "SwapFree",     offsetof(struct meminfo, swapfree) },
+    { "Dirty",        offsetof(struct meminfo, dirty) },
+    { "Writeback",    offsetof(struct meminfo, writeback) },
+    { "Shmem",        offsetof(struct meminfo, shmem) },
+    { "SReclaimable", offsetof(struct meminfo, sreclaimable) },
+    { "Zswap",        offsetof(struct meminfo, zswap) },
+    { "Zswapped",     offsetof(struct meminfo, zswapped) },
+};
+
+static struct meminfo *
+meminfo_read(void)
 {
-    char path[50];
-    char state[12];
-    FILE *fp;
+    char buf[4096];
+    char *line, *sep;
+    size_t i;
 
-    sprintf(path, "/sys/devices/platform/smapi/%s/state", bat);
-    fp = fopen(path, "r");
-    if (fp == NULL) {
-        warn("Failed to open file %s", path);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (meminfo.cycle == cycle) {
+        return &meminfo;
     }
-    fscanf(fp, "%11s", state);
-    fclose(fp);
 
-    if (!strcmp(state, "charging")) {
-        RETURN_FORMAT(20, BATT_CHARGING_STR);
-    } else if (!strcmp(state, "discharging")) {
-        RETURN_FORMAT(20, BATT_DISCHARGING_STR);
-    } else if (!strcmp(state, "idle")) {
-        RETURN_FORMAT(20, BATT_FULL_STR);
-    } else {
-        RETURN_FORMAT(20, BATT_UNKNOWN_STR);
+    if (readfile("/proc/meminfo", buf, sizeof(buf)) < 0) {
+        warn("Failed to open file /proc/meminfo");
+        return NULL;
+    }
+
+    memset(&meminfo, 0, sizeof(meminfo));
+    for (line = buf; line && (sep = strchr(line, ':')); line = strchr(sep, '\n')) {
+        if (*line == '\n') {
+            line++;
+        }
+        for (i = 0; i < LEN(meminfo_keys); i++) {
+            if (!strncmp(line, meminfo_keys[i].key, sep - line)
+                    && meminfo_keys[i].key[sep - line] == '\0') {
+                *(long *)((char *)&meminfo + meminfo_keys[i].off) = strtol(sep + 1, NULL, 10);
+                break;
+            }
+        }
     }
+    meminfo.cycle = cycle;
+
+    return &meminfo;
 }
 
-static char *
-battery_time_smapi(const char *bat)
-{
-    char path[70];
-    int time = -1;
-    FILE *fp;
+/* a battery's uevent file holds all of its values, it is read once
+ * per cycle and again right away when a power_supply uevent comes in */
+#define BATTERIES_MAX 4
+
+static struct battery {
+    char name[32];
+    unsigned long cycle;
+    char status[16];
+    long capacity; /* -1 when missing */
+    long energy_now, energy_full, power_now; /* uWh, uW */
+    long charge_now, charge_full, current_now; /* uAh, uA */
+    long voltage_now, voltage_min_design; /* uV */
+} batteries[BATTERIES_MAX];
+static int batteries_len;
+
+static const struct {
+    const char *key;
+    size_t off;
+} battery_keys[] = {
+    { "POWER_SUPPLY_CAPACITY",    offsetof(struct battery, capacity) },
+    { "POWER_SUPPLY_ENERGY_NOW",  offsetof(struct battery, energy_now) },
+    { "POWER_SUPPLY_ENERGY_FULL", offsetof(struct battery, energy_full) },
+    { "POWER_SUPPLY_POWER_NOW",   offsetof(struct battery, power_now) },
+    { "POWER_SUPPLY_CHARGE_NOW",  offsetof(struct battery, charge_now) },
+    { "POWER_SUPPLY_CHARGE_FULL", offsetof(struct battery, charge_full) },
+    { "POWER_SUPPLY_CURRENT_NOW", offsetof(struct battery, current_now) },
+    { "POWER_SUPPLY_VOLTAGE_NOW", offsetof(struct battery, voltage_now) },
+    { "POWER_SUPPLY_VOLTAGE_MIN_DESIGN", offsetof(struct battery, voltage_min_design) },
+};
+
+static Watch uevent = { -1, NULL };
 
-    sprintf(path, "/sys/devices/platform/smapi/%s/remaining_running_time_now", bat);
-    fp = fopen(path, "r");
-    if (fp == NULL) {
-        warn("Failed to open file %s", path);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+static void
+uevent_cb(Watch *w, uint32_t events)
+{
+    char buf[8192];
+    char *p;
+    ssize_t n;
+    int i, stale = 0;
+
+    /* messages are NUL separated "KEY=value" strings */
+    while ((n = recv(w->fd, buf, sizeof(buf) - 1, 0)) > 0 || (n < 0 && errno == ENOBUFS)) {
+        if (n < 0) {
+            stale = 1;
+            continue;
+        }
+        buf[n] = '\0';
+        for (p = buf; p < buf + n; p += strlen(p) + 1) {
+            if (!strcmp(p, "SUBSYSTEM=power_supply")) {
+                stale = 1;
+                break;
+            }
+        }
     }
-    fscanf(fp, "%d", &time);
-    fclose(fp);
 
-    if(time == -1) {
-        sprintf(path, "/sys/devices/platform/smapi/%s/remaining_charging_time", bat);
-        fp = fopen(path, "r");
-        if (fp == NULL) {
-            warn("Failed to open file %s", path);
-            RETURN_FORMAT(10, UNKNOWN_STR);
+    if (stale) {
+        for (i = 0; i < batteries_len; i++) {
+            batteries[i].cycle = 0;
         }
-        fscanf(fp, "%d", &time);
-        fclose(fp);
+        wake(battery_perc);
+        wake(battery_state);
+        wake(battery_time);
     }
+}
 
-    if (time == -1) {
-        RETURN_FORMAT(10, UNKNOWN_STR);
+static void
+uevent_init(void)
+{
+    struct sockaddr_nl sa = { .nl_family = AF_NETLINK, .nl_groups = 1 /* kernel */ };
+
+    /* only tried once, batteries are still polled without it */
+    uevent.cb = uevent_cb;
+    uevent.fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (uevent.fd < 0 || bind(uevent.fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        warn("Failed to open uevent socket");
+        if (uevent.fd >= 0) {
+            close(uevent.fd);
+            uevent.fd = -1;
+        }
+        return;
     }
-    RETURN_FORMAT(20, "%02d:%02d", time/60, time%60);
+    watch_add(&uevent, EPOLLIN);
 }
 
-static char *
-cpu_freq(void)
+static struct battery *
+battery_read(const char *bat, size_t len)
 {
-    int freq;
-    FILE *fp;
+    char path[PATH_MAX];
+    char buf[4096];
+    char *line, *sep;
+    struct battery *b;
+    size_t i;
+
+    if (!uevent.cb) {
+        uevent_init();
+    }
 
-    fp = fopen("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    for (i = 0; i < (size_t)batteries_len
+            && (strncmp(batteries[i].name, bat, len) || batteries[i].name[len]); i++);
+    if (i == BATTERIES_MAX) {
+        warnx("Too many batteries, not tracking %.*s", (int)len, bat);
+        return NULL;
+    } else if (i == (size_t)batteries_len) {
+        snprintf(batteries[i].name, sizeof(batteries[i].name), "%.*s", (int)len, bat);
+        batteries_len++;
+    }
+    b = &batteries[i];
+    if (b->cycle == cycle) {
+        return b;
+    }
+
+    snprintf(path, sizeof(path), "/sys/class/power_supply/%s/uevent", b->name);
+    if (readfile(path, buf, sizeof(buf)) < 0) {
+        warn("Failed to open file %s", path);
+        return NULL;
+    }
+
+    memset((char *)b + offsetof(struct battery, status), 0,
+            sizeof(*b) - offsetof(struct battery, status));
+    b->capacity = -1;
+    for (line = buf; (sep = strchr(line, '=')); line++) {
+        if (!strncmp(line, "POWER_SUPPLY_STATUS=", sep - line + 1)) {
+            sscanf(sep + 1, "%15[^\n]", b->status);
+        }
+        for (i = 0; i < LEN(battery_keys); i++) {
+            if (!strncmp(line, battery_keys[i].key, sep - line)
+                    && battery_keys[i].key[sep - line] == '\0') {
+                /* some drivers report discharging as a negative rate */
+                *(long *)((char *)b + battery_keys[i].off) = labs(strtol(sep + 1, NULL, 10));
+                break;
+            }
+        }
+        if (!(line = strchr(sep, '\n'))) {
+            break;
+        }
     }
-    fscanf(fp, "%d", &freq);
-    fclose(fp);
+    b->cycle = cycle;
 
-    RETURN_FORMAT(20, "%4dMHz", freq/1000);
+    return b;
 }
 
-static char *
-cpu_perc(long double ps_old[4])
+/* sums of every battery in bat, which can name several joined by '+',
+ * charge based batteries are converted to energy with their voltage or
+ * else their design minimum, without either only their percentage
+ * counts */
+struct battery_sum {
+    long long now, full, rate;
+    long long weighted; /* capacity times full */
+    int capacity, capacity_n;
+    int unknown; /* batteries left out of now, full and rate */
+    int charging, discharging, full_count, n;
+};
+
+static struct battery_sum *
+battery_sum(const char *bat, struct battery_sum *sum)
 {
-    int perc;
-    long double ps[4];
-    FILE *fp;
-
-    fp = fopen("/proc/stat", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/stat");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    struct battery *b;
+    size_t len;
+    long long now, full, rate;
+    long voltage;
+    int known;
+
+    memset(sum, 0, sizeof(*sum));
+    for (; *bat; bat += len + (bat[len] == '+')) {
+        len = strcspn(bat, "+");
+        if (!(b = battery_read(bat, len))) {
+            return NULL;
+        }
+        voltage = b->voltage_now ? b->voltage_now : b->voltage_min_design;
+        known = 1;
+        if (b->energy_full || b->energy_now) {
+            now = b->energy_now;
+            full = b->energy_full;
+            rate = b->power_now;
+        } else if (voltage) {
+            now = (long long)b->charge_now * voltage / 1000000;
+            full = (long long)b->charge_full * voltage / 1000000;
+            rate = (long long)b->current_now * voltage / 1000000;
+        } else {
+            known = 0;
+            sum->unknown++;
+        }
+        if (b->capacity >= 0) {
+            sum->capacity += b->capacity;
+            sum->capacity_n++;
+        } else if (!known && b->charge_full) {
+            /* uAh don't add up with uWh, but still make a percentage */
+            sum->capacity += 100 * b->charge_now / b->charge_full;
+            sum->capacity_n++;
+        }
+        if (known) {
+            sum->now += now;
+            sum->full += full;
+            sum->rate += rate;
+            if (b->capacity >= 0) {
+                sum->weighted += b->capacity * full;
+            } else if (full) {
+                sum->weighted += 100 * now;
+            }
+        }
+        sum->charging += !strcmp(b->status, "Charging");
+        sum->discharging += !strcmp(b->status, "Discharging");
+        sum->full_count += !strcmp(b->status, "Full");
+        sum->n++;
     }
-    fscanf(fp, "%*s %Lf %Lf %Lf %Lf",
-            &ps[0], &ps[1], &ps[2], &ps[3]);
-    fclose(fp);
 
-    perc = 100 * ((ps_old[0]+ps_old[1]+ps_old[2]) - (ps[0]+ps[1]+ps[2])) / ((ps_old[0]+ps_old[1]+ps_old[2]+ps_old[3]) - (ps[0]+ps[1]+ps[2]+ps[3]));
+    return sum->n ? sum : NULL;
+}
 
-    ps_old[0] = ps[0];
-    ps_old[1] = ps[1];
-    ps_old[2] = ps[2];
-    ps_old[3] = ps[3];
+/* energy samples of every battery argument battery_time and
+ * battery_watts are used on, the drain is the slope of a least squares
+ * fit over the last BATT_WINDOW ms, kept as running sums so adding and
+ * dropping a sample is constant time. samples are spaced at least
+ * BATT_WINDOW / BATT_SAMPLES apart so the ring spans the whole window
+ * at any interval */
+#define BATT_HISTORIES_MAX 4
+#define BATT_SAMPLES       128
+
+static struct batt_hist {
+    char name[64];
+    unsigned long cycle;
+    int state; /* 1 charging, -1 discharging, starts over on changes */
+    struct {
+        double t, e; /* s, uWh */
+    } ring[BATT_SAMPLES];
+    int head, len;
+    double st, se, stt, ste;
+} batt_hists[BATT_HISTORIES_MAX];
+static int batt_hists_len;
 
-    RETURN_FORMAT(5, "%02d%%", perc);
+static void
+batt_hist_push(struct batt_hist *h, double t, double e)
+{
+    int i = (h->head + h->len++) % BATT_SAMPLES;
+
+    h->ring[i].t = t;
+    h->ring[i].e = e;
+    h->st += t;
+    h->se += e;
+    h->stt += t * t;
+    h->ste += t * e;
 }
 
-static char *
-fan_ibm(void)
+static void
+batt_hist_pop(struct batt_hist *h)
 {
-    int fan;
-    FILE *fp;
+    double t = h->ring[h->head].t, e = h->ring[h->head].e;
+
+    h->head = (h->head + 1) % BATT_SAMPLES;
+    h->len--;
+    h->st -= t;
+    h->se -= e;
+    h->stt -= t * t;
+    h->ste -= t * e;
+}
 
-    fp = fopen("/proc/acpi/ibm/fan", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/acpi/ibm/fan");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+/* drain in uW over the window, falls back to what the batteries
+ * report until a tenth of the window is covered */
+static double
+battery_rate(const char *bat, struct battery_sum *sum)
+{
+    struct batt_hist *h;
+    struct timespec ts;
+    double t, n, det;
+    int i, state;
+
+    for (i = 0; i < batt_hists_len && strcmp(batt_hists[i].name, bat); i++);
+    if (i == BATT_HISTORIES_MAX) {
+        warnx("Too many battery histories, not tracking %s", bat);
+        return -1;
+    } else if (i == batt_hists_len) {
+        snprintf(batt_hists[i].name, sizeof(batt_hists[i].name), "%s", bat);
+        batt_hists_len++;
+    }
+    h = &batt_hists[i];
+
+    if (!battery_sum(bat, sum) || sum->unknown) {
+        return -1;
+    }
+    state = sum->discharging ? -1 : sum->charging ? 1 : 0;
+
+    if (h->cycle != cycle) {
+        h->cycle = cycle;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        t = ts.tv_sec + ts.tv_nsec / 1e9;
+
+        if (state != h->state) {
+            h->state = state;
+            h->head = h->len = 0;
+            h->st = h->se = h->stt = h->ste = 0;
+        }
+        while (h->len && (h->len == BATT_SAMPLES
+                    || t - h->ring[h->head].t > BATT_WINDOW / 1000.0)) {
+            batt_hist_pop(h);
+        }
+        if (!h->len || t - h->ring[(h->head + h->len - 1) % BATT_SAMPLES].t
+                >= BATT_WINDOW / 1000.0 / BATT_SAMPLES) {
+            batt_hist_push(h, t, sum->now);
+        }
+    }
+
+    n = h->len;
+    det = n * h->stt - h->st * h->st;
+    if (!state || n < 3 || det <= 0 || h->ring[(h->head + h->len - 1) % BATT_SAMPLES].t
+            - h->ring[h->head].t < BATT_WINDOW / 10000.0) {
+        return sum->rate;
     }
-    fscanf(fp, "%*s %*s\nspeed: %d", &fan);
-    fclose(fp);
 
-    RETURN_FORMAT(5, "%04d", fan);
+    /* slope is negative while discharging */
+    return MAX(state * (n * h->ste - h->st * h->se) / det * 3600, 0);
 }
 
 static char *
-datetime(const char *fmt)
+battery_perc(const char *bat, char *out, size_t outlen)
 {
-    time_t t;
-    char str[80];
+    struct battery_sum sum;
+    int perc;
 
-    t = time(NULL);
-    if (strftime(str, sizeof(str), fmt, localtime(&t)) == 0) {
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (!battery_sum(bat, &sum)) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    /* batteries count by their size when they report it */
+    if (sum.full && !sum.unknown) {
+        perc = MIN(sum.weighted / sum.full, 100);
+    } else if (sum.capacity_n) {
+        perc = sum.capacity / sum.capacity_n;
+    } else {
+        RETURN_FORMAT(UNKNOWN_STR);
     }
 
-    RETURN_FORMAT(80, "%s", str);
+    RETURN_FORMAT("%d%%", perc)
 }
 
 static char *
-disk_free(const char *mnt)
+battery_state(const char *bat, char *out, size_t outlen)
 {
-    struct statvfs fs;
+    struct battery_sum sum;
 
-    if (statvfs(mnt, &fs) < 0) {
-        warn("Failed to get filesystem info");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (!battery_sum(bat, &sum)) {
+        RETURN_FORMAT(UNKNOWN_STR);
     }
 
-    RETURN_FORMAT(10, "%f", (float)fs.f_bsize * (float)fs.f_bfree / 1024 / 1024 / 1024);
+    /* only one battery is used at a time, the others idle */
+    if (sum.discharging) {
+        RETURN_FORMAT(BATT_DISCHARGING_STR);
+    } else if (sum.charging) {
+        RETURN_FORMAT(BATT_CHARGING_STR);
+    } else if (sum.full_count == sum.n) {
+        RETURN_FORMAT(BATT_FULL_STR);
+    } else {
+        RETURN_FORMAT(BATT_UNKNOWN_STR);
+    }
 }
 
 static char *
-disk_perc(const char *mnt)
+battery_time(const char *bat, char *out, size_t outlen)
 {
-    int perc;
-    struct statvfs fs;
+    struct battery_sum sum;
+    double rate, hours;
 
-    if (statvfs(mnt, &fs) < 0) {
-        warn("Failed to get filesystem info");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if ((rate = battery_rate(bat, &sum)) <= 0) {
+        RETURN_FORMAT(UNKNOWN_STR);
     }
 
-    perc = 100 * (1.0f - ((float)fs.f_bfree / (float)fs.f_blocks));
+    /* time till empty, or till full while charging */
+    if (sum.discharging) {
+        hours = sum.now / rate;
+    } else if (sum.charging && sum.full > sum.now) {
+        hours = (sum.full - sum.now) / rate;
+    } else {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    /* a drain this small is the batteries idling, not an estimate */
+    if (hours >= 100) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
 
-    RETURN_FORMAT(5, "%d%%", perc);
+    RETURN_FORMAT("%02d:%02d", (int)hours, (int)((hours - (int)hours) * 60));
 }
 
 static char *
-disk_total(const char *mnt)
+battery_watts(const char *bat, char *out, size_t outlen)
 {
-    struct statvfs fs;
+    struct battery_sum sum;
+    double rate;
 
-    if (statvfs(mnt, &fs) < 0) {
-        warn("Failed to get filesystem info");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if ((rate = battery_rate(bat, &sum)) < 0) {
+        RETURN_FORMAT(UNKNOWN_STR);
     }
 
-    RETURN_FORMAT(10, "%f", (float)fs.f_bsize * (float)fs.f_blocks / 1024 / 1024 / 1024);
+    RETURN_FORMAT("%.1fW", rate / 1000000);
 }
 
 static char *
-disk_used(const char *mnt)
+battery_perc_smapi(const char *bat, char *out, size_t outlen)
 {
-    struct statvfs fs;
+    char path[60];
+    int perc;
+    char buf[16];
 
-    if (statvfs(mnt, &fs) < 0) {
-        warn("Failed to get filesystem info");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    sprintf(path, "/sys/devices/platform/smapi/%s/remaining_percent", bat);
+    if (readfile(path, buf, sizeof(buf)) < 0) {
+        warn("Failed to open file %s", path);
+        RETURN_FORMAT(UNKNOWN_STR);
     }
+    sscanf(buf, "%i", &perc);
 
-    RETURN_FORMAT(10, "%f", (float)fs.f_bsize * ((float)fs.f_blocks - (float)fs.f_bfree) / 1024 / 1024 / 1024);
+    RETURN_FORMAT("%d%%", perc);
 }
 
 static char *
-disk_io(void)
+battery_state_smapi(const char *bat, char *out, size_t outlen)
 {
-    int diskIO;
-    FILE *fp;
+    char path[50];
+    char state[12];
+    char buf[16];
 
-    fp = fopen("/proc/diskstats", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/diskstats");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    sprintf(path, "/sys/devices/platform/smapi/%s/state", bat);
+    if (readfile(path, buf, sizeof(buf)) < 0) {
+        warn("Failed to open file %s", path);
+        RETURN_FORMAT(UNKNOWN_STR);
     }
-    fscanf(fp, "%*d %*d %*s %*d %*d %*d %*d %*d %*d %*d %*d %d", &diskIO);
-    fclose(fp);
+    sscanf(buf, "%11s", state);
 
-    RETURN_FORMAT(5, "%02d", diskIO);
+    if (!strcmp(state, "charging")) {
+        RETURN_FORMAT(BATT_CHARGING_STR);
+    } else if (!strcmp(state, "discharging")) {
+        RETURN_FORMAT(BATT_DISCHARGING_STR);
+    } else if (!strcmp(state, "idle")) {
+        RETURN_FORMAT(BATT_FULL_STR);
+    } else {
+        RETURN_FORMAT(BATT_UNKNOWN_STR);
+    }
 }
 
 static char *
-entropy(void)
+battery_time_smapi(const char *bat, char *out, size_t outlen)
 {
-    int num;
-    FILE *fp;
+    char path[70];
+    int time = -1;
+    char buf[16];
 
-    fp= fopen("/proc/sys/kernel/random/entropy_avail", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/sys/kernel/random/entropy_avail");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    sprintf(path, "/sys/devices/platform/smapi/%s/remaining_running_time_now", bat);
+    if (readfile(path, buf, sizeof(buf)) < 0) {
+        warn("Failed to open file %s", path);
+        RETURN_FORMAT(UNKNOWN_STR);
     }
-    fscanf(fp, "%d", &num);
-    fclose(fp);
+    sscanf(buf, "%d", &time);
 
-    RETURN_FORMAT(10, "%d", num);
-}
+    if(time == -1) {
+        sprintf(path, "/sys/devices/platform/smapi/%s/remaining_charging_time", bat);
+        if (readfile(path, buf, sizeof(buf)) < 0) {
+            warn("Failed to open file %s", path);
+            RETURN_FORMAT(UNKNOWN_STR);
+        }
+        sscanf(buf, "%d", &time);
+    }
 
-static char *
-gid(void)
-{
-    RETURN_FORMAT(10, "%d", getgid());
+    if (time == -1) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    RETURN_FORMAT("%02d:%02d", time/60, time%60);
 }
 
 static char *
-hostname(void)
+cpu_freq(const char *unused, char *out, size_t outlen)
 {
-    char buf[HOST_NAME_MAX];
+    int freq;
+    char buf[16];
 
-    if (gethostname(buf, sizeof(buf)) == -1) {
-        warn("hostname");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (readfile("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq", buf, sizeof(buf)) < 0) {
+        warn("Failed to open file /sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq");
+        RETURN_FORMAT(UNKNOWN_STR);
     }
+    sscanf(buf, "%d", &freq);
 
-    RETURN_FORMAT(66, "%s", buf);
+    RETURN_FORMAT("%4dMHz", freq/1000);
 }
 
-static char *
-ip(const char *iface)
+/* /proc/stat is read once per cycle, deltas of every cpu line are
+ * taken against the previous read, row 0 being the aggregate */
+#define CPUS_MAX 256
+
+enum {
+    CPU_USER, CPU_NICE, CPU_SYSTEM, CPU_IDLE, CPU_IOWAIT,
+    CPU_IRQ, CPU_SOFTIRQ, CPU_STEAL, CPU_GUEST, CPU_GUEST_NICE,
+    CPU_FIELDS
+};
+
+static struct {
+    unsigned long cycle;
+    int rows;
+    unsigned long long cur[CPUS_MAX + 1][CPU_FIELDS];
+    unsigned long long old[CPUS_MAX + 1][CPU_FIELDS];
+    unsigned long long delta[CPUS_MAX + 1][CPU_FIELDS];
+    unsigned long long total[CPUS_MAX + 1];
+} cpustat;
+
+static int
+cpustat_read(void)
 {
-    struct ifaddrs *ifaddr, *ifa;
-    int s;
-    char host[NI_MAXHOST];
+    static char buf[32768];
+    char *p, *end;
+    int i, f, row;
+    unsigned long long t;
 
-    if (getifaddrs(&ifaddr) == -1) {
-        warn("Failed to get IP address for interface %s", iface);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (cpustat.cycle == cycle) {
+        return 0;
     }
-
-    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
-        if (ifa->ifa_addr == NULL) {
-            continue;
-        }
-        s = getnameinfo(ifa->ifa_addr, sizeof(struct sockaddr_in), host, NI_MAXHOST, NULL, 0, NI_NUMERICHOST);
-        if (!strcmp(ifa->ifa_name, iface) && (ifa->ifa_addr->sa_family == AF_INET)) {
-            if (s != 0) {
-                warnx("Failed to get IP address for interface %s", iface);
-                RETURN_FORMAT(10, UNKNOWN_STR);
+    if (readfile("/proc/stat", buf, sizeof(buf)) < 0) {
+        warn("Failed to open file /proc/stat");
+        return -1;
+    }
+    cpustat.cycle = cycle;
+
+    memcpy(cpustat.old, cpustat.cur, sizeof(cpustat.cur));
+    /* cpu lines come first, stop at the first other one */
+    for (p = buf; !strncmp(p, "cpu", 3); p = end + 1) {
+        p += 3;
+        row = *p == ' ' ? 0 : strtol(p, &p, 10) + 1;
+        for (f = 0; f < CPU_FIELDS; f++) {
+            t = strtoull(p, &p, 10);
+            if (row <= CPUS_MAX) {
+                cpustat.cur[row][f] = t;
             }
-            freeifaddrs(ifaddr);
-            RETURN_FORMAT(66, "%s", host);
+        }
+        if (row <= CPUS_MAX && row >= cpustat.rows) {
+            cpustat.rows = row + 1;
+        }
+        if (!(end = strchr(p, '\n'))) {
+            break;
         }
     }
 
-    freeifaddrs(ifaddr);
+    /* counters going backwards means the cpu went offline */
+    for (i = 0; i < cpustat.rows; i++) {
+        for (f = 0; f < CPU_FIELDS; f++) {
+            cpustat.delta[i][f] = cpustat.cur[i][f] >= cpustat.old[i][f]
+                ? cpustat.cur[i][f] - cpustat.old[i][f] : 0;
+        }
+    }
+    /* guest time is already part of user and nice */
+    for (i = 0; i < cpustat.rows; i++) {
+        t = 0;
+        for (f = 0; f < CPU_GUEST; f++) {
+            t += cpustat.delta[i][f];
+        }
+        cpustat.total[i] = t;
+    }
 
-    RETURN_FORMAT(10, UNKNOWN_STR);
+    return 0;
 }
 
-static char *
-load_avg(void)
+static int
+cpustat_busy(int row)
 {
-    double avgs[3];
+    unsigned long long idle;
 
-    if (getloadavg(avgs, 3) < 0) {
-        warnx("Failed to get the load avg");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (!cpustat.total[row]) {
+        return 0;
     }
+    idle = cpustat.delta[row][CPU_IDLE] + cpustat.delta[row][CPU_IOWAIT];
 
-    RETURN_FORMAT(50, "%.2f %.2f %.2f", avgs[0], avgs[1], avgs[2]);
+    return 100 * (cpustat.total[row] - idle) / cpustat.total[row];
 }
 
 static char *
-ram_free(void)
+cpu_core(const char *core, char *out, size_t outlen)
 {
-    long free;
-    FILE *fp;
+    int row = atoi(core) + 1;
 
-    fp = fopen("/proc/meminfo", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/meminfo");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (cpustat_read() < 0) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    if (row < 1 || row >= cpustat.rows) {
+        warnx("No such cpu %s", core);
+        RETURN_FORMAT(UNKNOWN_STR);
     }
-    fscanf(fp, "MemFree: %ld kB\n", &free);
-    fclose(fp);
 
-    RETURN_FORMAT(10, "%f", (float)free / 1024 / 1024);
+    RETURN_FORMAT("%02d%%", cpustat_busy(row));
 }
 
 static char *
-ram_perc(void)
+cpu_iowait(const char *unused, char *out, size_t outlen)
 {
-    long total, free, buffers, cached;
-    FILE *fp;
-
-    fp = fopen("/proc/meminfo", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/meminfo");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (cpustat_read() < 0 || !cpustat.total[0]) {
+        RETURN_FORMAT(UNKNOWN_STR);
     }
-    fscanf(fp, "MemTotal: %ld kB\n", &total);
-    fscanf(fp, "MemFree: %ld kB\n", &free);
-    fscanf(fp, "MemAvailable: %ld kB\nBuffers: %ld kB\n", &buffers, &buffers);
-    fscanf(fp, "Cached: %ld kB\n", &cached);
-    fclose(fp);
 
-    RETURN_FORMAT(5, "%ld%%", 100 * ((total - free) - (buffers + cached)) / total);
+    RETURN_FORMAT("%02d%%", (int)(100 * cpustat.delta[0][CPU_IOWAIT] / cpustat.total[0]));
 }
 
 static char *
-ram_total(void)
+cpu_max(const char *unused, char *out, size_t outlen)
 {
-    long total;
-    FILE *fp;
+    int i, perc, max = 0;
 
-    fp = fopen("/proc/meminfo", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/meminfo");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (cpustat_read() < 0) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    for (i = 1; i < cpustat.rows; i++) {
+        if ((perc = cpustat_busy(i)) > max) {
+            max = perc;
+        }
     }
-    fscanf(fp, "MemTotal: %ld kB\n", &total);
-    fclose(fp);
 
-    RETURN_FORMAT(10, "%f", (float)total / 1024 / 1024);
+    RETURN_FORMAT("%02d%%", max);
 }
 
 static char *
-ram_used(void)
+cpu_perc(const char *unused, char *out, size_t outlen)
 {
-    long free, total, buffers, cached;
-    FILE *fp;
-
-    fp = fopen("/proc/meminfo", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/meminfo");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (cpustat_read() < 0) {
+        RETURN_FORMAT(UNKNOWN_STR);
     }
-    fscanf(fp, "MemTotal: %ld kB\n", &total);
-    fscanf(fp, "MemFree: %ld kB\n", &free);
-    fscanf(fp, "MemAvailable: %ld kB\nBuffers: %ld kB\n", &buffers, &buffers);
-    fscanf(fp, "Cached: %ld kB\n", &cached);
-    fclose(fp);
 
-    RETURN_FORMAT(10, "%f", (float)(total - free - buffers - cached) / 1024 / 1024);
+    RETURN_FORMAT("%02d%%", cpustat_busy(0));
 }
 
 static char *
-run_command(const char *cmd)
+cpu_steal(const char *unused, char *out, size_t outlen)
 {
-    FILE *fp;
-    char buf[1024] = "n/a";
-
-    fp = popen(cmd, "r");
-    if (fp == NULL) {
-        warn("Failed to get command output for %s", cmd);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (cpustat_read() < 0 || !cpustat.total[0]) {
+        RETURN_FORMAT(UNKNOWN_STR);
     }
-    fgets(buf, sizeof(buf)-1, fp);
-    pclose(fp);
-
-    buf[strlen(buf)] = '\0';
-    strtok(buf, "\n");
 
-    RETURN_FORMAT(256, "%s", buf);
+    RETURN_FORMAT("%02d%%", (int)(100 * cpustat.delta[0][CPU_STEAL] / cpustat.total[0]));
 }
 
 static char *
-swap_free(void)
+fan_ibm(const char *unused, char *out, size_t outlen)
 {
-    long total, free;
-    FILE *fp;
-    char buf[2048];
-    size_t bytes_read;
-    char *match;
-
-    fp = fopen("/proc/meminfo", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/meminfo");
-        RETURN_FORMAT(10, UNKNOWN_STR);
-    }
-    bytes_read = fread(buf, sizeof(char), sizeof(buf), fp);
-    buf[bytes_read] = '\0';
-    fclose(fp);
-    if (bytes_read == 0 || bytes_read == sizeof(buf)) {
-        warn("Failed to read /proc/meminfo\n");
-        RETURN_FORMAT(10, UNKNOWN_STR);
-    }
+    int fan;
+    char buf[128];
 
-    match = strstr(buf, "SwapTotal");
-    sscanf(match, "SwapTotal: %ld kB\n", &total);
-    if (total == 0) {
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (readfile("/proc/acpi/ibm/fan", buf, sizeof(buf)) < 0) {
+        warn("Failed to open file /proc/acpi/ibm/fan");
+        RETURN_FORMAT(UNKNOWN_STR);
     }
+    sscanf(buf, "%*s %*s\nspeed: %d", &fan);
 
-    match = strstr(buf, "SwapFree");
-    sscanf(match, "SwapFree: %ld kB\n", &free);
-
-    RETURN_FORMAT(10, "%f", (float)free / 1024 / 1024);
+    RETURN_FORMAT("%04d", fan);
 }
 
 static char *
-swap_perc(void)
+datetime(const char *fmt, char *out, size_t outlen)
 {
-    long total, free, cached;
-    FILE *fp;
-    char buf[2048];
-    size_t bytes_read;
-    char *match;
+    time_t t;
+    struct tm tm;
+    char str[80];
 
-    fp = fopen("/proc/meminfo", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/meminfo");
-        RETURN_FORMAT(10, UNKNOWN_STR);
-    }
-    bytes_read = fread(buf, sizeof(char), sizeof(buf), fp);
-    buf[bytes_read] = '\0';
-    fclose(fp);
-    if (bytes_read == 0 || bytes_read == sizeof(buf)) {
-        warn("Failed to read /proc/meminfo\n");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    t = time(NULL);
+    if (strftime(str, sizeof(str), fmt, localtime_r(&t, &tm)) == 0) {
+        RETURN_FORMAT(UNKNOWN_STR);
     }
 
-    match = strstr(buf, "SwapTotal");
-    sscanf(match, "SwapTotal: %ld kB\n", &total);
-    if (total == 0) {
-        RETURN_FORMAT(10, UNKNOWN_STR);
-    }
+    RETURN_FORMAT("%s", str);
+}
+
+/* statvfs of every mountpoint disk_* functions are used on, shared
+ * for a cycle, disk_total only asks again every DISK_TOTAL_REFRESH ms,
+ * a change to the mount table drops everything, locked since disk_*
+ * can run on worker threads */
+#define MOUNTS_MAX 64
+
+static struct {
+    char *mnt; /* NULL for a free entry */
+    int pinned; /* named by an entry, not just matched by a glob */
+    unsigned long cycle, gen;
+    unsigned long ts; /* ms */
+    struct statvfs fs;
+    int valid; /* fs holds a value, maybe an old one */
+    int err; /* of the last statvfs */
+    int busy; /* a statvfs is asked for or running, maybe stuck */
+    unsigned long probe_cycle, probe_gen;
+    unsigned long helper; /* id of its thread, 0 for none */
+    pthread_cond_t asked;
+} mounts[MOUNTS_MAX];
+static int mounts_len;
+static unsigned long mounts_gen = 1;
+static unsigned long mounts_helpers;
+static int mounts_waiting; /* let go of mounts_lock in mounts_wait */
+static pthread_mutex_t mounts_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mounts_done;
+static Watch mountinfo = { -1, NULL };
+
+static void
+mountinfo_cb(Watch *w, uint32_t events)
+{
+    /* polling mountinfo again clears the event */
+    pthread_mutex_lock(&mounts_lock);
+    mounts_gen++;
+    pthread_mutex_unlock(&mounts_lock);
+
+    wake(disk_free);
+    wake(disk_fullest);
+    wake(disk_perc);
+    wake(disk_total);
+    wake(disk_used);
+}
 
-    match = strstr(buf, "SwapCached");
-    sscanf(match, "SwapCached: %ld kB\n", &cached);
+/* every mount has a helper thread that runs statvfs whenever it is
+ * asked to, one that never returns from a dead network mount takes
+ * nothing else with it, and as the mount stays busy it is not asked
+ * again until it does return. it leaves once the entry is recycled
+ * and no longer carries its id */
+static void *
+mount_probe(void *arg)
+{
+    int i = (intptr_t)arg % MOUNTS_MAX, ret;
+    unsigned long id = (intptr_t)arg / MOUNTS_MAX;
+    struct statvfs fs;
 
-    match = strstr(buf, "SwapFree");
-    sscanf(match, "SwapFree: %ld kB\n", &free);
+    pthread_mutex_lock(&mounts_lock);
+    for (;;) {
+        while (!mounts[i].busy && mounts[i].helper == id) {
+            pthread_cond_wait(&mounts[i].asked, &mounts_lock);
+        }
+        if (mounts[i].helper != id) {
+            break;
+        }
+        pthread_mutex_unlock(&mounts_lock);
+
+        ret = statvfs(rooted(mounts[i].mnt), &fs);
+
+        pthread_mutex_lock(&mounts_lock);
+        mounts[i].err = ret < 0 ? errno : 0;
+        if (!ret && mounts[i].probe_gen == mounts_gen) {
+            mounts[i].fs = fs;
+            mounts[i].valid = 1;
+            mounts[i].gen = mounts[i].probe_gen;
+            mounts[i].cycle = mounts[i].probe_cycle;
+            mounts[i].ts = now_ms();
+        }
+        mounts[i].busy = 0;
+        pthread_cond_broadcast(&mounts_done);
+    }
+    pthread_mutex_unlock(&mounts_lock);
 
-    RETURN_FORMAT(5, "%ld%%", 100 * (total - free - cached) / total);
+    return NULL;
 }
 
-static char *
-swap_total(void)
+/* the rest expects mounts_lock to be held */
+static void
+mounts_init(void)
 {
-    long total;
-    FILE *fp;
-    char buf[2048];
-    size_t bytes_read;
-    char *match;
+    pthread_condattr_t cattr;
+    int i;
 
-    fp = fopen("/proc/meminfo", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/meminfo");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (mountinfo.cb) {
+        return;
     }
-    bytes_read = fread(buf, sizeof(char), sizeof(buf), fp);
-    buf[bytes_read] = '\0';
-    fclose(fp);
-    if (bytes_read == 0 || bytes_read == sizeof(buf)) {
-        warn("Failed to read /proc/meminfo\n");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    mountinfo.cb = mountinfo_cb;
+    /* the same file mount_list reads the mountpoints from */
+    if ((mountinfo.fd = reader_open("/proc/self/mountinfo")) < 0
+            || watch_add(&mountinfo, EPOLLPRI) < 0) {
+        if (epfd >= 0) {
+            warn("Failed to watch /proc/self/mountinfo, rereading it every time");
+        }
+        if (mountinfo.fd >= 0) {
+            close(mountinfo.fd);
+            mountinfo.fd = -1;
+        }
     }
-
-    match = strstr(buf, "SwapTotal");
-    sscanf(match, "SwapTotal: %ld kB\n", &total);
-    if (total == 0) {
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&mounts_done, &cattr);
+    pthread_condattr_destroy(&cattr);
+    for (i = 0; i < MOUNTS_MAX; i++) {
+        pthread_cond_init(&mounts[i].asked, NULL);
     }
-
-    RETURN_FORMAT(10, "%f", (float)total / 1024 / 1024);
 }
 
-static char *
-swap_used(void)
+static int
+mount_get(const char *mnt)
 {
-    long total, free, cached;
-    FILE *fp;
-    char buf[2048];
-    size_t bytes_read;
-    char *match;
+    char *dup;
+    int i, unused = -1;
 
-    fp = fopen("/proc/meminfo", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/meminfo");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    mounts_init();
+    for (i = 0; i < mounts_len && (!mounts[i].mnt || strcmp(mounts[i].mnt, mnt)); i++) {
+        if (!mounts[i].mnt && unused < 0) {
+            unused = i;
+        }
     }
-    bytes_read = fread(buf, sizeof(char), sizeof(buf), fp);
-    buf[bytes_read] = '\0';
-    fclose(fp);
-    if (bytes_read == 0 || bytes_read == sizeof(buf)) {
-        warn("Failed to read /proc/meminfo\n");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (i < mounts_len) {
+        return i;
+    } else if (unused < 0 && i == MOUNTS_MAX) {
+        warnx("Too many mountpoints, not watching %s", mnt);
+        return -1;
     }
 
-    match = strstr(buf, "SwapTotal");
-    sscanf(match, "SwapTotal: %ld kB\n", &total);
-    if (total == 0) {
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (!(dup = strdup(mnt))) {
+        warn("Failed to allocate memory");
+        return -1;
     }
+    /* a recycled entry keeps only its condition variable */
+    i = unused >= 0 ? unused : mounts_len++;
+    mounts[i].mnt = dup;
+    mounts[i].pinned = mounts[i].valid = mounts[i].err = 0;
+    mounts[i].cycle = mounts[i].gen = 0;
 
-    match = strstr(buf, "SwapCached");
-    sscanf(match, "SwapCached: %ld kB\n", &cached);
-
-    match = strstr(buf, "SwapFree");
-    sscanf(match, "SwapFree: %ld kB\n", &free);
+    return i;
+}
 
-    RETURN_FORMAT(10, "%f", (float)(total - free - cached) / 1024 / 1024);
+static int
+mount_fresh(int i, int capacity)
+{
+    return mounts[i].valid && mounts[i].gen == mounts_gen && (mounts[i].cycle == cycle
+            || (capacity && now_ms() - mounts[i].ts < DISK_TOTAL_REFRESH));
 }
 
-static char *
-temp(const char *file)
+/* returns whether a new statvfs was started, none is while one is
+ * still running */
+static int
+mount_start(int i)
 {
-    int temp;
-    FILE *fp;
+    pthread_attr_t attr;
+    pthread_t t;
+    int ret;
 
-    fp = fopen(file, "r");
-    if (fp == NULL) {
-        warn("Failed to open file %s", file);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (mounts[i].busy) {
+        return 0;
+    }
+    if (!mounts[i].helper) {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        ret = pthread_create(&t, &attr, mount_probe,
+                (void *)(intptr_t)(++mounts_helpers * MOUNTS_MAX + i));
+        pthread_attr_destroy(&attr);
+        if (ret) {
+            errno = ret;
+            warn("Failed to start thread for %s", mounts[i].mnt);
+            return 0;
+        }
+        mounts[i].helper = mounts_helpers;
     }
-    fscanf(fp, "%d", &temp);
-    fclose(fp);
+    mounts[i].busy = 1;
+    mounts[i].probe_cycle = cycle;
+    mounts[i].probe_gen = mounts_gen;
+    /* an old helper of a recycled entry may still be waiting on it too */
+    pthread_cond_broadcast(&mounts[i].asked);
 
-    RETURN_FORMAT(20, "%d°C", temp / 1000);
+    return 1;
 }
 
-static char *
-temp_workaround(const char *file, const char *file_)
+/* 0 for a fresh value, 1 for the last known one of a mount that did not
+ * answer within DISK_TIMEOUT ms, -1 if there is none */
+static int
+mount_result(int i, int capacity, struct statvfs *fs)
 {
-    int temp;
-    FILE *fp;
-
-    fp = fopen(file, "r");
-    if (fp == NULL) {
-        fp = fopen(file_, "r");
-    } if (fp == NULL) {
-        warn("Failed to open files %s and %s", file, file_);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (mount_fresh(i, capacity)) {
+        *fs = mounts[i].fs;
+        return 0;
+    } else if (!mounts[i].busy && mounts[i].err) {
+        errno = mounts[i].err;
+        return -1;
+    } else if (mounts[i].valid) {
+        *fs = mounts[i].fs;
+        return 1;
     }
-    fscanf(fp, "%d", &temp);
-    fclose(fp);
+    errno = ETIMEDOUT;
 
-    RETURN_FORMAT(20, "%d°C", temp / 1000);
+    return -1;
 }
 
-static char *
-uptime(void)
+static void
+mounts_wait(const int *idx, int n, const int *started)
 {
-    struct sysinfo info;
+    unsigned long deadline = now_ms() + DISK_TIMEOUT;
+    struct timespec ts = { deadline / 1000, deadline % 1000 * 1000000 };
+    int i;
+
+    /* only for the ones started now, stuck ones would just time out again */
+    mounts_waiting++;
+    for (i = 0; i < n; i++) {
+        while (started[i] && mounts[idx[i]].busy
+                && pthread_cond_timedwait(&mounts_done, &mounts_lock, &ts) != ETIMEDOUT);
+    }
+    mounts_waiting--;
+}
+
+static int
+disk_stat(const char *mnt, struct statvfs *fs, int capacity)
+{
+    int i, started = 0, ret = -1;
+
+    pthread_mutex_lock(&mounts_lock);
+    if ((i = mount_get(mnt)) >= 0) {
+        mounts[i].pinned = 1;
+        if (!mount_fresh(i, capacity)) {
+            started = mount_start(i);
+            mounts_wait(&i, 1, &started);
+        }
+        ret = mount_result(i, capacity, fs);
+    }
+    pthread_mutex_unlock(&mounts_lock);
+
+    return ret;
+}
+
+/* free space, what unprivileged users can still write with DISK_AVAIL */
+#define DISK_FREE(fs) (DISK_AVAIL ? (fs).f_bavail : (fs).f_bfree)
+/* like df, space reserved for root counts as neither */
+#define DISK_PERC(fs) (int)(100 * (1.0f - ((float)DISK_FREE(fs) \
+                / (float)((fs).f_blocks - (fs).f_bfree + DISK_FREE(fs)))))
+
+static char *
+disk_free(const char *mnt, char *out, size_t outlen)
+{
+    struct statvfs fs;
+    int stale;
+
+    if ((stale = disk_stat(mnt, &fs, 0)) < 0) {
+        warn("Failed to get filesystem info");
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f%s", (float)fs.f_frsize * (float)DISK_FREE(fs) / 1024 / 1024 / 1024,
+            stale ? DISK_STALE_STR : "");
+}
+
+/* mountpoints a list of patterns matches, taken from mountinfo again
+ * after the mount table changed, patterns without wildcards are used
+ * as they are */
+#define MOUNT_LISTS_MAX 4
+
+static struct {
+    const char *mnts;
+    unsigned long gen;
+    int idx[MOUNTS_MAX];
+    int len;
+} mount_lists[MOUNT_LISTS_MAX];
+static int mount_lists_len;
+
+/* mounts only a glob matched come and go with removable media and
+ * containers, drop the ones no list holds anymore and stop their
+ * helpers, one still stuck in statvfs is left for a later round */
+static void
+mounts_recycle(void)
+{
+    int i, j, k;
+
+    /* a waiter may hold on to entries its list has since dropped */
+    if (mounts_waiting) {
+        return;
+    }
+    for (i = 0; i < mounts_len; i++) {
+        if (!mounts[i].mnt || mounts[i].pinned || mounts[i].busy) {
+            continue;
+        }
+        for (j = 0; j < mount_lists_len; j++) {
+            for (k = 0; k < mount_lists[j].len && mount_lists[j].idx[k] != i; k++);
+            if (k < mount_lists[j].len) {
+                break;
+            }
+        }
+        if (j < mount_lists_len) {
+            continue;
+        }
+        free(mounts[i].mnt);
+        mounts[i].mnt = NULL;
+        mounts[i].helper = 0;
+        pthread_cond_broadcast(&mounts[i].asked);
+    }
+}
+
+static void
+mount_list_add(int i, int j)
+{
+    int k;
+
+    /* overlapping patterns match the same mount more than once */
+    for (k = 0; k < mount_lists[i].len && mount_lists[i].idx[k] != j; k++);
+    if (k == mount_lists[i].len && k < MOUNTS_MAX) {
+        mount_lists[i].idx[mount_lists[i].len++] = j;
+    }
+}
+
+static int
+mount_list(const char *mnts, int **idx)
+{
+    static char *buf;
+    static size_t size = 65536;
+    char pat[PATH_MAX], mnt[PATH_MAX];
+    char *line, *p, *q;
+    const char *m;
+    int i, j, k, n, loaded = 0;
+
+    /* watched even while nothing matches, so a later mount is noticed */
+    mounts_init();
+    for (i = 0; i < mount_lists_len && mount_lists[i].mnts != mnts; i++);
+    if (i == MOUNT_LISTS_MAX) {
+        warnx("Too many mount lists, not watching %s", mnts);
+        return -1;
+    } else if (i == mount_lists_len) {
+        mount_lists[mount_lists_len++].mnts = mnts;
+    }
+    *idx = mount_lists[i].idx;
+    /* without the watch nothing bumps mounts_gen */
+    if (mountinfo.fd >= 0 && mount_lists[i].gen == mounts_gen) {
+        return mount_lists[i].len;
+    }
+
+    mount_lists[i].len = 0;
+    for (m = mnts; *(m += strspn(m, " ")); m += n) {
+        n = strcspn(m, " ");
+        snprintf(pat, sizeof(pat), "%.*s", n, m);
+        if (!strpbrk(pat, "*?[")) {
+            if ((j = mount_get(pat)) >= 0) {
+                mount_list_add(i, j);
+            }
+            continue;
+        }
+        /* once for all the patterns */
+        if (!loaded && readfile_grow("/proc/self/mountinfo", &buf, &size) < 0) {
+            warn("Failed to open file /proc/self/mountinfo");
+            return -1;
+        }
+        loaded = 1;
+        for (line = buf; line; line = (line = strchr(line, '\n')) ? line + 1 : NULL) {
+            if (sscanf(line, "%*s %*s %*s %*s %4095s", mnt) != 1) {
+                continue;
+            }
+            /* spaces and such are escaped as \040 */
+            for (p = q = mnt; *p; p++) {
+                if (*p == '\\' && sscanf(p + 1, "%3o", &k) == 1) {
+                    *q++ = k;
+                    p += 3;
+                } else {
+                    *q++ = *p;
+                }
+            }
+            *q = '\0';
+            if (!fnmatch(pat, mnt, FNM_PATHNAME) && (j = mount_get(mnt)) >= 0) {
+                mount_list_add(i, j);
+            }
+        }
+    }
+    mount_lists[i].gen = mounts_gen;
+    mounts_recycle();
+
+    return mount_lists[i].len;
+}
+
+static char *
+disk_fullest(const char *mnts, char *out, size_t outlen)
+{
+    struct statvfs fs;
+    char name[PATH_MAX];
+    int started[MOUNTS_MAX];
+    int *idx;
+    int i, n, ret, perc, best = -1, best_perc = -1, best_stale = 0;
+
+    pthread_mutex_lock(&mounts_lock);
+    if ((n = mount_list(mnts, &idx)) < 0) {
+        pthread_mutex_unlock(&mounts_lock);
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    /* ask every mount at once, then wait for them together */
+    for (i = 0; i < n; i++) {
+        started[i] = !mount_fresh(idx[i], 0) && mount_start(idx[i]);
+    }
+    mounts_wait(idx, n, started);
+
+    for (i = 0; i < n; i++) {
+        if ((ret = mount_result(idx[i], 0, &fs)) < 0 || !fs.f_blocks) {
+            continue;
+        }
+        if ((perc = DISK_PERC(fs)) > best_perc) {
+            best = idx[i];
+            best_perc = perc;
+            best_stale = ret;
+        }
+    }
+    if (best >= 0) {
+        /* the entry can be recycled as soon as the lock is gone */
+        snprintf(name, sizeof(name), "%s", mounts[best].mnt);
+    }
+    pthread_mutex_unlock(&mounts_lock);
+
+    if (best < 0) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%s %d%%%s", name, best_perc, best_stale ? DISK_STALE_STR : "");
+}
+
+static char *
+disk_perc(const char *mnt, char *out, size_t outlen)
+{
+    struct statvfs fs;
+    int stale;
+
+    if ((stale = disk_stat(mnt, &fs, 0)) < 0) {
+        warn("Failed to get filesystem info");
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%d%%%s", DISK_PERC(fs), stale ? DISK_STALE_STR : "");
+}
+
+static char *
+disk_total(const char *mnt, char *out, size_t outlen)
+{
+    struct statvfs fs;
+    int stale;
+
+    if ((stale = disk_stat(mnt, &fs, 1)) < 0) {
+        warn("Failed to get filesystem info");
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f%s", (float)fs.f_frsize * (float)fs.f_blocks / 1024 / 1024 / 1024,
+            stale ? DISK_STALE_STR : "");
+}
+
+static char *
+disk_used(const char *mnt, char *out, size_t outlen)
+{
+    struct statvfs fs;
+    int stale;
+
+    if ((stale = disk_stat(mnt, &fs, 0)) < 0) {
+        warn("Failed to get filesystem info");
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f%s", (float)fs.f_frsize * ((float)fs.f_blocks - (float)fs.f_bfree) / 1024 / 1024 / 1024,
+            stale ? DISK_STALE_STR : "");
+}
+
+/* /proc/diskstats is read once per cycle into a table of every
+ * device's counters, sectors are always 512 bytes there */
+#define DISKSTATS_MAX 256
+
+enum {
+    DISK_READS, DISK_READ_MERGES, DISK_READ_SECTORS, DISK_READ_MS,
+    DISK_WRITES, DISK_WRITE_MERGES, DISK_WRITE_SECTORS, DISK_WRITE_MS,
+    DISK_INFLIGHT, DISK_IO_MS, DISK_WEIGHTED_MS,
+    DISK_FIELDS
+};
+
+static struct diskstat {
+    char name[32];
+    unsigned long long c[DISK_FIELDS];
+} diskstats[DISKSTATS_MAX];
+static int diskstats_len;
+static unsigned long diskstats_cycle;
+static struct timespec diskstats_ts;
+
+static struct diskstat *
+diskstat_read(const char *dev)
+{
+    static char buf[65536];
+    char *p, *end;
+    struct diskstat *d;
+    int i, f;
+
+    if (diskstats_cycle != cycle) {
+        if (readfile("/proc/diskstats", buf, sizeof(buf)) < 0) {
+            warn("Failed to open file /proc/diskstats");
+            return NULL;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &diskstats_ts);
+        diskstats_cycle = cycle;
+
+        diskstats_len = 0;
+        for (p = buf; *p && diskstats_len < DISKSTATS_MAX; p = end + 1) {
+            d = &diskstats[diskstats_len];
+            strtoul(p, &p, 10);
+            strtoul(p, &p, 10);
+            p += strspn(p, " ");
+            i = strcspn(p, " \n");
+            snprintf(d->name, sizeof(d->name), "%.*s", i, p);
+            p += i;
+            for (f = 0; f < DISK_FIELDS; f++) {
+                d->c[f] = strtoull(p, &p, 10);
+            }
+            if (i) {
+                diskstats_len++;
+            }
+            if (!(end = strchr(p, '\n'))) {
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < diskstats_len; i++) {
+        if (!strcmp(diskstats[i].name, dev)) {
+            return &diskstats[i];
+        }
+    }
+    warnx("No such block device %s", dev);
+
+    return NULL;
+}
+
+/* counters of every device disk_* functions are used on, all of them
+ * share one delta per cycle taken over the real time passed */
+#define DISKS_MAX 16
+
+static struct disk {
+    char name[32];
+    int primed;
+    unsigned long cycle;
+    unsigned long long c[DISK_FIELDS];
+    unsigned long long delta[DISK_FIELDS];
+    struct timespec ts;
+    double dt;
+} disks[DISKS_MAX];
+static int disks_len;
+
+static struct disk *
+disk_delta(const char *dev)
+{
+    int i, f;
+    struct diskstat *d;
+
+    for (i = 0; i < disks_len && strcmp(disks[i].name, dev); i++);
+    if (i == DISKS_MAX) {
+        warnx("Too many block devices, not tracking %s", dev);
+        return NULL;
+    } else if (i == disks_len) {
+        snprintf(disks[i].name, sizeof(disks[i].name), "%s", dev);
+        disks_len++;
+    }
+
+    if (!(d = diskstat_read(dev))) {
+        disks[i].primed = 0;
+        return NULL;
+    }
+
+    if (disks[i].cycle != cycle) {
+        disks[i].cycle = cycle;
+        disks[i].dt = 0;
+        memset(disks[i].delta, 0, sizeof(disks[i].delta));
+        if (disks[i].primed) {
+            disks[i].dt = (diskstats_ts.tv_sec - disks[i].ts.tv_sec)
+                + (diskstats_ts.tv_nsec - disks[i].ts.tv_nsec) / 1e9;
+            /* counters going backwards means the device was replaced */
+            for (f = 0; f < DISK_FIELDS; f++) {
+                disks[i].delta[f] = d->c[f] >= disks[i].c[f] ? d->c[f] - disks[i].c[f] : 0;
+            }
+        }
+        disks[i].primed = 1;
+        memcpy(disks[i].c, d->c, sizeof(d->c));
+        disks[i].ts = diskstats_ts;
+    }
+
+    return &disks[i];
+}
+
+static char *
+disk_bytes(const char *dev, int sectors, char *out, size_t outlen)
+{
+    struct disk *d;
+    double val;
+
+    if (!(d = disk_delta(dev))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    val = d->dt > 0 ? d->delta[sectors] * 512 / d->dt : 0;
+
+    if (val < 1000) {
+        RETURN_FORMAT("%-4.3g B/s", val);
+    } else if (val < 1000000) {
+        RETURN_FORMAT("%-4.3gKB/s", val/1000.0);
+    } else if (val < 1000000000){
+        RETURN_FORMAT("%-4.3gMB/s", val/1000000.0);
+    } else {
+        RETURN_FORMAT("%-4.3gGB/s", val/1000000000.0);
+    }
+}
+
+static char *
+disk_io(const char *dev, char *out, size_t outlen)
+{
+    struct diskstat *d;
+
+    if (!(d = diskstat_read(dev))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%02llu", d->c[DISK_INFLIGHT]);
+}
+
+static char *
+disk_iops(const char *dev, char *out, size_t outlen)
+{
+    struct disk *d;
+
+    if (!(d = disk_delta(dev))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    } else if (d->dt <= 0) {
+        RETURN_FORMAT("0/0");
+    }
+
+    RETURN_FORMAT("%.0f/%.0f", d->delta[DISK_READS] / d->dt, d->delta[DISK_WRITES] / d->dt);
+}
+
+static char *
+disk_lat(const char *dev, char *out, size_t outlen)
+{
+    struct disk *d;
+    unsigned long long ios;
+
+    if (!(d = disk_delta(dev))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    ios = d->delta[DISK_READS] + d->delta[DISK_WRITES];
+
+    RETURN_FORMAT("%.1fms", ios ? (double)(d->delta[DISK_READ_MS] + d->delta[DISK_WRITE_MS]) / ios : 0);
+}
+
+static char *
+disk_read(const char *dev, char *out, size_t outlen)
+{
+    return disk_bytes(dev, DISK_READ_SECTORS, out, outlen);
+}
+
+static char *
+disk_util(const char *dev, char *out, size_t outlen)
+{
+    struct disk *d;
+    int perc;
+
+    if (!(d = disk_delta(dev))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    /* share of the time the device had any io in flight */
+    perc = d->dt > 0 ? MIN(100 * d->delta[DISK_IO_MS] / (d->dt * 1000), 100) : 0;
+
+    RETURN_FORMAT("%d%%", perc);
+}
+
+static char *
+disk_write(const char *dev, char *out, size_t outlen)
+{
+    return disk_bytes(dev, DISK_WRITE_SECTORS, out, outlen);
+}
+
+static char *
+entropy(const char *unused, char *out, size_t outlen)
+{
+    int num;
+    char buf[16];
+
+    if (readfile("/proc/sys/kernel/random/entropy_avail", buf, sizeof(buf)) < 0) {
+        warn("Failed to open file /proc/sys/kernel/random/entropy_avail");
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    sscanf(buf, "%d", &num);
+
+    RETURN_FORMAT("%d", num);
+}
+
+static char *
+gid(const char *unused, char *out, size_t outlen)
+{
+    RETURN_FORMAT("%d", getgid());
+}
+
+static char *
+hostname(const char *unused, char *out, size_t outlen)
+{
+    char buf[HOST_NAME_MAX];
+
+    if (gethostname(buf, sizeof(buf)) == -1) {
+        warn("hostname");
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%s", buf);
+}
+
+/* links, addresses and default routes are kept up to date from
+ * rtnetlink events instead of walking getifaddrs() every time */
+#define RTNL_LINKS_MAX  128
+#define RTNL_ADDRS_MAX  128
+#define RTNL_ROUTES_MAX 16
+
+static struct {
+    int index;
+    char name[IFNAMSIZ];
+} rtnl_links[RTNL_LINKS_MAX];
+static int rtnl_links_len;
+
+static struct {
+    int index;
+    int family;
+    unsigned char scope;
+    char str[INET6_ADDRSTRLEN];
+} rtnl_addrs[RTNL_ADDRS_MAX];
+static int rtnl_addrs_len;
+
+static struct {
+    int index;
+    int family;
+    unsigned int metric;
+} rtnl_routes[RTNL_ROUTES_MAX];
+static int rtnl_routes_len;
+
+static Watch rtnl = { -1, NULL };
+static int rtnl_dump; /* dumps are requested one after another */
+static const int rtnl_dumps[] = { RTM_GETLINK, RTM_GETADDR, RTM_GETROUTE };
+
+static void
+rtnl_request(int type)
+{
+    struct {
+        struct nlmsghdr nh;
+        struct rtgenmsg g;
+    } req = {
+        .nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg)),
+        .nh.nlmsg_type = type,
+        .nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+        .g.rtgen_family = AF_UNSPEC,
+    };
+
+    if (send(rtnl.fd, &req, req.nh.nlmsg_len, 0) < 0) {
+        warn("Failed to request rtnetlink dump");
+    }
+}
+
+static void
+rtnl_link(struct nlmsghdr *nh)
+{
+    struct ifinfomsg *ifi = NLMSG_DATA(nh);
+    struct rtattr *rta;
+    int len = IFLA_PAYLOAD(nh);
+    int i;
+
+    for (i = 0; i < rtnl_links_len && rtnl_links[i].index != ifi->ifi_index; i++);
+
+    if (nh->nlmsg_type == RTM_DELLINK) {
+        if (i < rtnl_links_len) {
+            rtnl_links[i] = rtnl_links[--rtnl_links_len];
+        }
+        return;
+    }
+    if (i == RTNL_LINKS_MAX) {
+        warnx("Too many network interfaces, ignoring %d", ifi->ifi_index);
+        return;
+    }
+
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_IFNAME) {
+            rtnl_links[i].index = ifi->ifi_index;
+            snprintf(rtnl_links[i].name, sizeof(rtnl_links[i].name), "%s", (char *)RTA_DATA(rta));
+            if (i == rtnl_links_len) {
+                rtnl_links_len++;
+            }
+        }
+    }
+}
+
+static void
+rtnl_addr(struct nlmsghdr *nh)
+{
+    struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+    struct rtattr *rta;
+    int len = IFA_PAYLOAD(nh);
+    void *addr = NULL;
+    char str[INET6_ADDRSTRLEN];
+    int i;
+
+    if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6) {
+        return;
+    }
+    for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        /* IFA_LOCAL is the own end of point-to-point links */
+        if (rta->rta_type == IFA_LOCAL || (rta->rta_type == IFA_ADDRESS && !addr)) {
+            addr = RTA_DATA(rta);
+        }
+    }
+    if (!addr || !inet_ntop(ifa->ifa_family, addr, str, sizeof(str))) {
+        return;
+    }
+
+    for (i = 0; i < rtnl_addrs_len; i++) {
+        if (rtnl_addrs[i].index == (int)ifa->ifa_index
+                && rtnl_addrs[i].family == ifa->ifa_family
+                && !strcmp(rtnl_addrs[i].str, str)) {
+            break;
+        }
+    }
+
+    if (nh->nlmsg_type == RTM_DELADDR) {
+        if (i < rtnl_addrs_len) {
+            rtnl_addrs[i] = rtnl_addrs[--rtnl_addrs_len];
+        }
+        return;
+    }
+    if (i == RTNL_ADDRS_MAX) {
+        warnx("Too many addresses, ignoring %s", str);
+        return;
+    }
+    rtnl_addrs[i].index = ifa->ifa_index;
+    rtnl_addrs[i].family = ifa->ifa_family;
+    rtnl_addrs[i].scope = ifa->ifa_scope;
+    memcpy(rtnl_addrs[i].str, str, sizeof(str));
+    if (i == rtnl_addrs_len) {
+        rtnl_addrs_len++;
+    }
+}
+
+static void
+rtnl_route(struct nlmsghdr *nh)
+{
+    struct rtmsg *rtm = NLMSG_DATA(nh);
+    struct rtattr *rta;
+    int len = RTM_PAYLOAD(nh);
+    int i, index = 0;
+    unsigned int metric = 0;
+
+    /* only default routes are of interest */
+    if (rtm->rtm_dst_len != 0 || rtm->rtm_table != RT_TABLE_MAIN
+            || rtm->rtm_type != RTN_UNICAST) {
+        return;
+    }
+    for (rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == RTA_OIF) {
+            index = *(int *)RTA_DATA(rta);
+        } else if (rta->rta_type == RTA_PRIORITY) {
+            metric = *(unsigned int *)RTA_DATA(rta);
+        }
+    }
+
+    for (i = 0; i < rtnl_routes_len; i++) {
+        if (rtnl_routes[i].index == index && rtnl_routes[i].family == rtm->rtm_family
+                && rtnl_routes[i].metric == metric) {
+            break;
+        }
+    }
+
+    if (nh->nlmsg_type == RTM_DELROUTE) {
+        if (i < rtnl_routes_len) {
+            rtnl_routes[i] = rtnl_routes[--rtnl_routes_len];
+        }
+        return;
+    }
+    if (i == RTNL_ROUTES_MAX) {
+        return;
+    }
+    rtnl_routes[i].index = index;
+    rtnl_routes[i].family = rtm->rtm_family;
+    rtnl_routes[i].metric = metric;
+    if (i == rtnl_routes_len) {
+        rtnl_routes_len++;
+    }
+}
+
+static void
+rtnl_cb(Watch *w, uint32_t events)
+{
+    char buf[8192];
+    struct nlmsghdr *nh;
+    ssize_t n;
+
+    while ((n = recv(w->fd, buf, sizeof(buf), 0)) > 0 || (n < 0 && errno == ENOBUFS)) {
+        if (n < 0) {
+            /* missed events, start over from fresh dumps */
+            rtnl_links_len = rtnl_addrs_len = rtnl_routes_len = 0;
+            rtnl_dump = 0;
+            rtnl_request(rtnl_dumps[rtnl_dump++]);
+            continue;
+        }
+        for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, n); nh = NLMSG_NEXT(nh, n)) {
+            switch (nh->nlmsg_type) {
+            case NLMSG_DONE:
+                if (rtnl_dump < (int)LEN(rtnl_dumps)) {
+                    rtnl_request(rtnl_dumps[rtnl_dump++]);
+                }
+                break;
+            case RTM_NEWLINK:
+            case RTM_DELLINK:
+                rtnl_link(nh);
+                break;
+            case RTM_NEWADDR:
+            case RTM_DELADDR:
+                rtnl_addr(nh);
+                break;
+            case RTM_NEWROUTE:
+            case RTM_DELROUTE:
+                rtnl_route(nh);
+                break;
+            }
+        }
+    }
+
+    wake(ip);
+    wake(ip6);
+}
+
+static int
+rtnl_init(void)
+{
+    struct sockaddr_nl sa = {
+        .nl_family = AF_NETLINK,
+        .nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR
+            | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE,
+    };
+
+    rtnl.fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (rtnl.fd < 0 || bind(rtnl.fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        warn("Failed to open rtnetlink socket");
+        if (rtnl.fd >= 0) {
+            close(rtnl.fd);
+            rtnl.fd = -1;
+        }
+        return -1;
+    }
+    rtnl.cb = rtnl_cb;
+    watch_add(&rtnl, EPOLLIN);
+    rtnl_request(rtnl_dumps[rtnl_dump++]);
+
+    return 0;
+}
+
+static const char *
+rtnl_lookup(const char *iface, int family)
+{
+    int i, index = 0, best = -1;
+    unsigned int metric = UINT_MAX;
+
+    if (rtnl.fd < 0 && rtnl_init() < 0) {
+        return NULL;
+    }
+
+    if (!strcmp(iface, "default")) {
+        /* the interface holding the default route with the lowest metric */
+        for (i = 0; i < rtnl_routes_len; i++) {
+            if (rtnl_routes[i].family == family && rtnl_routes[i].metric <= metric) {
+                index = rtnl_routes[i].index;
+                metric = rtnl_routes[i].metric;
+            }
+        }
+    } else {
+        for (i = 0; i < rtnl_links_len; i++) {
+            if (!strcmp(rtnl_links[i].name, iface)) {
+                index = rtnl_links[i].index;
+                break;
+            }
+        }
+    }
+    if (!index) {
+        return NULL;
+    }
+
+    /* prefer global addresses over link local ones */
+    for (i = 0; i < rtnl_addrs_len; i++) {
+        if (rtnl_addrs[i].index == index && rtnl_addrs[i].family == family
+                && (best < 0 || rtnl_addrs[i].scope < rtnl_addrs[best].scope)) {
+            best = i;
+        }
+    }
+
+    return best < 0 ? NULL : rtnl_addrs[best].str;
+}
+
+static char *
+ip(const char *iface, char *out, size_t outlen)
+{
+    const char *addr;
+
+    if (!(addr = rtnl_lookup(iface, AF_INET))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%s", addr);
+}
+
+static char *
+ip6(const char *iface, char *out, size_t outlen)
+{
+    const char *addr;
+
+    if (!(addr = rtnl_lookup(iface, AF_INET6))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%s", addr);
+}
+
+static char *
+load_avg(const char *unused, char *out, size_t outlen)
+{
+    double avgs[3];
+
+    if (getloadavg(avgs, 3) < 0) {
+        warnx("Failed to get the load avg");
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%.2f %.2f %.2f", avgs[0], avgs[1], avgs[2]);
+}
+
+static char *
+ram_dirty(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read())) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f", (float)mi->dirty / 1024 / 1024);
+}
+
+static char *
+ram_free(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read())) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f", (float)mi->free / 1024 / 1024);
+}
+
+static char *
+ram_perc(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read()) || !mi->total) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%ld%%", 100 * ((mi->total - mi->free) - (mi->buffers + mi->cached)) / mi->total);
+}
+
+static char *
+ram_shmem(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read())) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f", (float)mi->shmem / 1024 / 1024);
+}
+
+static char *
+ram_sreclaimable(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read())) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f", (float)mi->sreclaimable / 1024 / 1024);
+}
+
+static char *
+ram_total(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read())) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f", (float)mi->total / 1024 / 1024);
+}
+
+static char *
+ram_used(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read())) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f", (float)(mi->total - mi->free - mi->buffers - mi->cached) / 1024 / 1024);
+}
+
+static char *
+ram_writeback(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read())) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f", (float)mi->writeback / 1024 / 1024);
+}
+
+/* commands run in the background with their output read as it arrives,
+ * the last complete output keeps showing until a new one is in */
+#define COMMANDS_MAX 16
+
+static struct command {
+    Watch w; /* stdout pipe, first so the watch is the command */
+    char *cmd;
+    int stream;
+    int full;
+    pid_t pid;
+    unsigned long started;
+    char buf[VALUE_MAX];
+    size_t len;
+    char val[VALUE_MAX];
+} commands[COMMANDS_MAX];
+static int commands_len;
+
+extern char **environ;
+
+static void command_cb(Watch *w, uint32_t events);
+
+static struct command *
+command_get(const char *cmd, int stream)
+{
+    int i;
+    struct command *c;
+
+    for (i = 0; i < commands_len; i++) {
+        if (commands[i].stream == stream && !strcmp(commands[i].cmd, cmd)) {
+            return &commands[i];
+        }
+    }
+    if (commands_len == COMMANDS_MAX) {
+        warnx("Too many commands, not running %s", cmd);
+        return NULL;
+    }
+
+    c = &commands[commands_len++];
+    c->cmd = strdup(cmd);
+    c->stream = stream;
+    c->w.fd = -1;
+    c->w.cb = command_cb;
+    snprintf(c->val, sizeof(c->val), UNKNOWN_STR);
+
+    return c;
+}
+
+static void
+command_spawn(struct command *c)
+{
+    int fds[2];
+    char *argv[] = { "sh", "-c", c->cmd, NULL };
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t mask;
+
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        warn("Failed to get command output for %s", c->cmd);
+        return;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, fds[1], STDOUT_FILENO);
+    /* own process group so a timeout kills the whole pipeline,
+     * and unblock the signals the main loop reads from its signalfd */
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, 0);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+
+    if (posix_spawn(&c->pid, "/bin/sh", &fa, &attr, argv, environ) != 0) {
+        warn("Failed to get command output for %s", c->cmd);
+        c->pid = 0;
+        close(fds[0]);
+    } else {
+        c->w.fd = fds[0];
+        c->len = 0;
+        c->full = 0;
+        c->started = now_ms();
+        if (watch_add(&c->w, EPOLLIN) < 0) {
+            warn("Failed to watch command output for %s", c->cmd);
+        }
+    }
+    close(fds[1]);
+
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+}
+
+static void
+command_done(struct command *c)
+{
+    watch_del(&c->w);
+    close(c->w.fd);
+    c->w.fd = -1;
+    if (waitpid(c->pid, NULL, WNOHANG) != 0) {
+        c->pid = 0;
+    }
+}
+
+static void
+command_read(struct command *c)
+{
+    ssize_t n;
+    char *nl, drop[256];
+
+    for (;;) {
+        if (c->full) {
+            n = read(c->w.fd, drop, sizeof(drop));
+        } else {
+            n = read(c->w.fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+        }
+        if (n <= 0) {
+            break;
+        } else if (c->full) {
+            continue;
+        }
+        c->len += n;
+
+        /* streams show every complete line, other commands only their first */
+        while ((nl = memchr(c->buf, '\n', c->len))) {
+            if (!c->stream) {
+                c->len = nl - c->buf;
+                c->full = 1;
+                break;
+            }
+            *nl = '\0';
+            snprintf(c->val, sizeof(c->val), "%s", c->buf);
+            slots_set(run_stream, c->cmd, c->val);
+            c->len -= nl + 1 - c->buf;
+            memmove(c->buf, nl + 1, c->len);
+        }
+        if (c->len == sizeof(c->buf) - 1) {
+            /* line too long, cut it off */
+            c->full = !c->stream;
+            c->len = c->stream ? 0 : c->len;
+        }
+    }
+
+    if (n == 0) {
+        if (!c->stream) {
+            c->buf[c->len] = '\0';
+            snprintf(c->val, sizeof(c->val), "%s", c->len ? c->buf : UNKNOWN_STR);
+            slots_set(run_command, c->cmd, c->val);
+        }
+        command_done(c);
+    } else if (errno != EAGAIN) {
+        warn("Failed to get command output for %s", c->cmd);
+        command_done(c);
+    }
+}
+
+static void
+command_cb(Watch *w, uint32_t events)
+{
+    command_read((struct command *)w);
+}
+
+static void
+commands_check(unsigned long now)
+{
+    int i;
+    struct command *c;
+
+    for (i = 0; i < commands_len; i++) {
+        c = &commands[i];
+        if (c->w.fd >= 0 && !c->stream && now - c->started >= COMMAND_TIMEOUT) {
+            warnx("Command timed out: %s", c->cmd);
+            kill(-c->pid, SIGKILL);
+            command_done(c);
+        }
+        if (c->w.fd < 0 && c->pid && waitpid(c->pid, NULL, WNOHANG) != 0) {
+            c->pid = 0;
+        }
+    }
+}
+
+static unsigned long
+commands_deadline(void)
+{
+    int i;
+    unsigned long deadline = ULONG_MAX;
+
+    for (i = 0; i < commands_len; i++) {
+        if (commands[i].w.fd >= 0 && !commands[i].stream
+                && commands[i].started + COMMAND_TIMEOUT < deadline) {
+            deadline = commands[i].started + COMMAND_TIMEOUT;
+        }
+    }
+
+    return deadline;
+}
+
+static void
+commands_kill(void)
+{
+    int i;
+
+    for (i = 0; i < commands_len; i++) {
+        if (commands[i].pid) {
+            kill(-commands[i].pid, SIGTERM);
+        }
+    }
+}
+
+static char *
+run_command(const char *cmd, char *out, size_t outlen)
+{
+    struct command *c;
+
+    if (!(c = command_get(cmd, 0))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    if (!c->pid) {
+        /* the last output shows until this run is done */
+        command_spawn(c);
+    }
+
+    RETURN_FORMAT("%s", c->val);
+}
+
+static char *
+run_stream(const char *cmd, char *out, size_t outlen)
+{
+    struct command *c;
+
+    if (!(c = command_get(cmd, 1))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    if (!c->pid) {
+        /* not running (anymore), (re)start it */
+        command_spawn(c);
+    }
+
+    RETURN_FORMAT("%s", c->val);
+}
+
+static char *
+swap_free(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read()) || !mi->swaptotal) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f", (float)mi->swapfree / 1024 / 1024);
+}
+
+static char *
+swap_perc(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read()) || !mi->swaptotal) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%ld%%", 100 * (mi->swaptotal - mi->swapfree - mi->swapcached) / mi->swaptotal);
+}
+
+static char *
+swap_total(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read()) || !mi->swaptotal) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f", (float)mi->swaptotal / 1024 / 1024);
+}
+
+static char *
+swap_used(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read()) || !mi->swaptotal) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%f", (float)(mi->swaptotal - mi->swapfree - mi->swapcached) / 1024 / 1024);
+}
+
+static char *
+temp(const char *file, char *out, size_t outlen)
+{
+    int temp;
+    char buf[16];
+
+    if (readfile(file, buf, sizeof(buf)) < 0) {
+        warn("Failed to open file %s", file);
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    sscanf(buf, "%d", &temp);
+
+    RETURN_FORMAT("%d°C", temp / 1000);
+}
+
+static char *
+temp_workaround(const char *files, char *out, size_t outlen)
+{
+    int temp;
+    char buf[16];
+    char file[PATH_MAX];
+    const char *file_;
+
+    /* two locations separated by a space */
+    file_ = strchr(files, ' ');
+    if (file_ == NULL) {
+        warnx("Expected two files separated by a space in %s", files);
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    snprintf(file, sizeof(file), "%.*s", (int)(file_++ - files), files);
+
+    if (readfile(file, buf, sizeof(buf)) < 0
+            && readfile(file_, buf, sizeof(buf)) < 0) {
+        warn("Failed to open files %s and %s", file, file_);
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    sscanf(buf, "%d", &temp);
+
+    RETURN_FORMAT("%d°C", temp / 1000);
+}
+
+static char *
+uptime(const char *unused, char *out, size_t outlen)
+{
+    struct sysinfo info;
     int h = 0;
     int m = 0;
 
-    sysinfo(&info);
-    h = info.uptime / 3600;
-    m = (info.uptime - h * 3600 ) / 60;
+    sysinfo(&info);
+    h = info.uptime / 3600;
+    m = (info.uptime - h * 3600 ) / 60;
+
+    RETURN_FORMAT("%dh %dm", h, m);
+}
+
+static char *
+username(const char *unused, char *out, size_t outlen)
+{
+    uid_t uid = geteuid();
+    struct passwd *pw = getpwuid(uid);
+
+    if (pw == NULL) {
+        warn("Failed to get username");
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%s", pw->pw_name);
+}
+
+static char *
+uid(const char *unused, char *out, size_t outlen)
+{
+    RETURN_FORMAT("%d", geteuid());
+}
+
+#ifndef PULSE
+/* mixers are opened once per card with their poll descriptors in the
+ * main loop, the volume is only read again once alsa reports a change */
+#define ALSA_MIXERS_MAX 4
+#define ALSA_FDS_MAX 4
+
+static struct alsa_mixer {
+    char *card;
+    snd_mixer_t *handle;
+    snd_mixer_elem_t *elem;
+    struct alsa_fd {
+        Watch w; /* first so the watch is the fd */
+        struct alsa_mixer *m;
+    } fds[ALSA_FDS_MAX];
+    int nfds;
+} alsa_mixers[ALSA_MIXERS_MAX];
+static int alsa_mixers_len;
+
+static void
+alsa_close(struct alsa_mixer *m)
+{
+    int i;
+
+    for (i = 0; i < m->nfds; i++) {
+        watch_del(&m->fds[i].w);
+    }
+    m->nfds = 0;
+    if (m->handle) {
+        snd_mixer_close(m->handle);
+    }
+    m->handle = NULL;
+    m->elem = NULL;
+}
+
+static void
+alsa_cb(Watch *w, uint32_t events)
+{
+    struct alsa_mixer *m = ((struct alsa_fd *)w)->m;
+
+    if (!m->handle) {
+        return;
+    } else if (events & (EPOLLERR | EPOLLHUP)) {
+        /* card went away, reopened on the next sample */
+        alsa_close(m);
+    } else {
+        snd_mixer_handle_events(m->handle);
+    }
+    wake(vol_perc_alsa);
+}
+
+static int
+alsa_open(struct alsa_mixer *m)
+{
+    snd_mixer_selem_id_t *s_elem;
+    struct pollfd pfds[ALSA_FDS_MAX];
+    int i, n;
+
+    snd_mixer_selem_id_alloca(&s_elem);
+    snd_mixer_selem_id_set_name(s_elem, "Master");
+    if (snd_mixer_open(&m->handle, 0) < 0) {
+        m->handle = NULL;
+        return -1;
+    }
+    if (snd_mixer_attach(m->handle, m->card) < 0
+            || snd_mixer_selem_register(m->handle, NULL, NULL) < 0
+            || snd_mixer_load(m->handle) < 0
+            || !(m->elem = snd_mixer_find_selem(m->handle, s_elem))
+            || (n = snd_mixer_poll_descriptors(m->handle, pfds, LEN(pfds))) < 0) {
+        alsa_close(m);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        m->fds[i].w.fd = pfds[i].fd;
+        m->fds[i].w.cb = alsa_cb;
+        m->fds[i].m = m;
+        if (watch_add(&m->fds[i].w, (pfds[i].events & POLLIN ? EPOLLIN : 0)
+                    | (pfds[i].events & POLLOUT ? EPOLLOUT : 0)) < 0) {
+            alsa_close(m);
+            return -1;
+        }
+        m->nfds++;
+    }
+
+    return 0;
+}
+
+static char *
+vol_perc_alsa(const char *card, char *out, size_t outlen)
+{
+    int i, mute;
+    long vol, max, min, vol_perc;
+    struct alsa_mixer *m;
+
+    for (i = 0; i < alsa_mixers_len && strcmp(alsa_mixers[i].card, card); i++);
+    if (i == ALSA_MIXERS_MAX) {
+        warnx("Too many sound cards, not opening %s", card);
+        RETURN_FORMAT(UNKNOWN_STR);
+    } else if (i == alsa_mixers_len) {
+        alsa_mixers[i].card = strdup(card);
+        alsa_mixers_len++;
+    }
+    m = &alsa_mixers[i];
+
+    if (!m->handle && alsa_open(m) < 0) {
+        warnx("Failed to get volume percentage for %s", card);
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    snd_mixer_selem_get_playback_volume_range(m->elem, &min, &max);
+    snd_mixer_selem_get_playback_volume(m->elem, 0, &vol);
+    snd_mixer_selem_get_playback_switch(m->elem, 0, &mute);
+
+    vol_perc = max > min ? (vol - min) * 100 / (max - min) : 0;
+    if (!mute) {
+        RETURN_FORMAT(VOL_MUTE_STR);
+    } else if (vol_perc == 0) {
+        RETURN_FORMAT(VOL_ZERO_STR);
+    } else {
+        RETURN_FORMAT(VOL_STR, (int)vol_perc);
+    }
+}
+#endif
+
+#ifdef PULSE
+static char *
+vol_perc_pulse(const char *unused, char *out, size_t outlen)
+{
+    RETURN_FORMAT(pulse_vol_str);
+}
+
+static char *
+micvol_perc_pulse(const char *unused, char *out, size_t outlen)
+{
+    RETURN_FORMAT(pulse_micvol_str);
+}
+
+static char *
+pulse_profile(const char *unused, char *out, size_t outlen)
+{
+    RETURN_FORMAT(pulse_profile_str);
+}
+
+static char *
+pulse_profile_icon(const char *unused, char *out, size_t outlen)
+{
+    if (!strcmp(PULSE_HEADPHONE_STR, pulse_profile_str)) {
+        RETURN_FORMAT(PULSE_HEADPHONE_ICON);
+    } else if (!strcmp(PULSE_SPEAKER_STR, pulse_profile_str)) {
+        RETURN_FORMAT(PULSE_SPEAKER_ICON);
+    } else if (!strcmp(PULSE_HDMI_STR, pulse_profile_str)) {
+        RETURN_FORMAT(PULSE_HDMI_ICON);
+    }
+    RETURN_FORMAT(UNKNOWN_STR);
+}
+
+/* sink/source the status follows, found once by matching descriptions
+ * and after that only queried by index when pulse reports a change
+ * to it, bursts of events are coalesced into one query per object */
+enum { PULSE_SINK = 1, PULSE_SINKS = 2, PULSE_SOURCE = 4, PULSE_SOURCES = 8 };
+
+static uint32_t pulse_sink = PA_INVALID_INDEX;
+static uint32_t pulse_source = PA_INVALID_INDEX;
+static int pulse_pending;
+static pa_defer_event *pulse_defer;
+
+static void
+pulse_query_cb(pa_mainloop_api *a, pa_defer_event *e, void *userdata)
+{
+    pa_context *c = pulse_ctx;
+
+    a->defer_enable(e, 0);
+    if (pulse_pending & PULSE_SINKS) {
+        pa_operation_unref(pa_context_get_sink_info_list(c, pulse_sink_info_cb, NULL));
+    } else if (pulse_pending & PULSE_SINK) {
+        pa_operation_unref(pa_context_get_sink_info_by_index(c, pulse_sink, pulse_sink_info_cb, NULL));
+    }
+    if (pulse_pending & PULSE_SOURCES) {
+        pa_operation_unref(pa_context_get_source_info_list(c, pulse_source_info_cb, NULL));
+    } else if (pulse_pending & PULSE_SOURCE) {
+        pa_operation_unref(pa_context_get_source_info_by_index(c, pulse_source, pulse_source_info_cb, NULL));
+    }
+    pulse_pending = 0;
+}
+
+static void
+pulse_query(int what)
+{
+    pulse_pending |= what;
+    if (pulse_defer) {
+        pulse_api.defer_enable(pulse_defer, 1);
+    }
+}
+
+static void
+pulse_context_state_cb(pa_context *c, void *userdata)
+{
+    switch(pa_context_get_state(c)) {
+        case PA_CONTEXT_CONNECTING:
+        case PA_CONTEXT_AUTHORIZING:
+        case PA_CONTEXT_SETTING_NAME:
+            break;
+        case PA_CONTEXT_READY:; /* <- note the semi-colon, very important */
+            if (!pulse_defer) {
+                pulse_defer = pulse_api.defer_new(&pulse_api, pulse_query_cb, NULL);
+            }
+            pa_context_set_subscribe_callback(c, pulse_volume_change_cb, NULL);
+            pa_operation_unref(pa_context_subscribe(c, PA_SUBSCRIPTION_MASK_SINK | PA_SUBSCRIPTION_MASK_SOURCE, NULL, NULL));
+            pulse_query(PULSE_SINKS | PULSE_SOURCES);
+            break;
+        case PA_CONTEXT_TERMINATED:
+            /* our own disconnect on exit, main drops the context */
+            break;
+        default:
+            fprintf(stderr, "pulse connection failure: %s\n",
+                    pa_strerror(pa_context_errno(c)));
+
+            sprintf(pulse_vol_str, UNKNOWN_STR);
+            sprintf(pulse_profile_str, UNKNOWN_STR);
+            pulse_wake();
+            if (pulse_defer) {
+                pulse_api.defer_free(pulse_defer);
+                pulse_defer = NULL;
+            }
+            pa_context_unref(c);
+            pulse_ctx = NULL;
+            break;
+    }
+}
+
+static void
+pulse_sink_info_cb(pa_context *c, const pa_sink_info *sink_info, int eol, void *userdata)
+{
+    if (eol < 0 && pulse_sink != PA_INVALID_INDEX) {
+        /* it's gone, look for a match again */
+        pulse_sink = PA_INVALID_INDEX;
+        pulse_query(PULSE_SINKS);
+    } else if (sink_info && pulse_sink == PA_INVALID_INDEX
+            && strstr(sink_info->description, SINK_MATCH)) {
+        pulse_sink = sink_info->index;
+    }
+
+    if (sink_info && sink_info->index == pulse_sink) {
+        sprintf(pulse_profile_str, sink_info->name);
+
+        pa_volume_t vol = (int)(pa_cvolume_avg(&sink_info->volume) * 100.0 
+                / (sink_info->n_volume_steps-1) + .5);
+
+		if (!sink_info->n_volume_steps) {
+			vol = (int)(pa_cvolume_avg(&sink_info->volume) * 100.0 
+							/ (65500-1) + .5);
+		}
+
+        if (sink_info->mute) {
+            sprintf(pulse_vol_str, VOL_MUTE_STR);
+        } else if (vol == 0) {
+            sprintf(pulse_vol_str, VOL_ZERO_STR "%%");
+        } else {
+            sprintf(pulse_vol_str, VOL_STR "%%", vol);
+        }
+        pulse_wake();
+    }
+}
+
+static void
+pulse_source_info_cb(pa_context *c, const pa_source_info *source_info, int eol, void *userdata)
+{
+    if (eol < 0 && pulse_source != PA_INVALID_INDEX) {
+        /* it's gone, look for a match again */
+        pulse_source = PA_INVALID_INDEX;
+        pulse_query(PULSE_SOURCES);
+    } else if (source_info && pulse_source == PA_INVALID_INDEX
+            && strstr(source_info->description, SOURCE_MATCH)) {
+        pulse_source = source_info->index;
+    }
+
+    if (source_info && source_info->index == pulse_source) {
+        pa_volume_t vol = (int)(pa_cvolume_avg(&source_info->volume) * 100.0 
+                / (source_info->n_volume_steps-1) + .5);
+
+		if (!source_info->n_volume_steps) {
+			vol = (int)(pa_cvolume_avg(&source_info->volume) * 100.0 
+							/ (65500-1) + .5);
+		}
+
+        if (source_info->mute) {
+            sprintf(pulse_micvol_str, VOL_MUTE_STR);
+        } else if (vol == 0) {
+            sprintf(pulse_micvol_str, VOL_ZERO_STR "%%");
+        } else {
+            sprintf(pulse_micvol_str, VOL_STR "%%", vol);
+        }
+        pulse_wake();
+    }
+}
+
+static void
+pulse_volume_change_cb(pa_context *c, pa_subscription_event_type_t t, 
+        uint32_t idx, void *userdata)
+{
+    int type = t & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+
+    /* only events about the followed sink/source matter,
+     * or any while there is none that matches yet */
+    switch (t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) {
+        case PA_SUBSCRIPTION_EVENT_SINK:
+            if (idx == pulse_sink && type == PA_SUBSCRIPTION_EVENT_REMOVE) {
+                pulse_sink = PA_INVALID_INDEX;
+                pulse_query(PULSE_SINKS);
+            } else if (idx == pulse_sink) {
+                pulse_query(PULSE_SINK);
+            } else if (pulse_sink == PA_INVALID_INDEX) {
+                pulse_query(PULSE_SINKS);
+            }
+            break;
+        case PA_SUBSCRIPTION_EVENT_SOURCE:
+            if (idx == pulse_source && type == PA_SUBSCRIPTION_EVENT_REMOVE) {
+                pulse_source = PA_INVALID_INDEX;
+                pulse_query(PULSE_SOURCES);
+            } else if (idx == pulse_source) {
+                pulse_query(PULSE_SOURCE);
+            } else if (pulse_source == PA_INVALID_INDEX) {
+                pulse_query(PULSE_SOURCES);
+            }
+            break;
+    }
+}
+
+static void
+pulse_wake(void)
+{
+    wake(pulse_profile);
+    wake(pulse_profile_icon);
+    wake(vol_perc_pulse);
+    wake(micvol_perc_pulse);
+}
+
+/* pa_mainloop_api on top of the main loop's epoll set, so pulse
+ * runs in the same thread and wakes the bar only on its events */
+#define PULSE_TIMEVAL_RTCLOCK (1L << 30) /* tv_usec flag libpulse sets on monotonic times */
+
+struct pa_io_event {
+    Watch w; /* first so the watch is the event */
+    int dead;
+    pa_io_event_cb_t cb;
+    pa_io_event_destroy_cb_t destroy;
+    void *userdata;
+    pa_io_event *next;
+};
+
+struct pa_time_event {
+    struct timeval tv;
+    unsigned long deadline;
+    int dead;
+    pa_time_event_cb_t cb;
+    pa_time_event_destroy_cb_t destroy;
+    void *userdata;
+    pa_time_event *next;
+};
+
+struct pa_defer_event {
+    int enabled;
+    int dead;
+    pa_defer_event_cb_t cb;
+    pa_defer_event_destroy_cb_t destroy;
+    void *userdata;
+    pa_defer_event *next;
+};
+
+static pa_io_event *pulse_ios;
+static pa_time_event *pulse_times;
+static pa_defer_event *pulse_defers;
+
+static uint32_t
+pulse_epoll_flags(pa_io_event_flags_t events)
+{
+    return (events & PA_IO_EVENT_INPUT ? EPOLLIN : 0)
+        | (events & PA_IO_EVENT_OUTPUT ? EPOLLOUT : 0);
+}
+
+static void
+pulse_io_cb(Watch *w, uint32_t events)
+{
+    pa_io_event *e = (pa_io_event *)w;
+
+    if (!e->dead) {
+        e->cb(&pulse_api, e, w->fd,
+                (events & EPOLLIN ? PA_IO_EVENT_INPUT : 0)
+                | (events & EPOLLOUT ? PA_IO_EVENT_OUTPUT : 0)
+                | (events & EPOLLHUP ? PA_IO_EVENT_HANGUP : 0)
+                | (events & EPOLLERR ? PA_IO_EVENT_ERROR : 0), e->userdata);
+    }
+}
+
+static pa_io_event *
+pulse_io_new(pa_mainloop_api *a, int fd, pa_io_event_flags_t events,
+        pa_io_event_cb_t cb, void *userdata)
+{
+    pa_io_event *e = calloc(1, sizeof(*e));
+
+    e->w.fd = fd;
+    e->w.cb = pulse_io_cb;
+    e->cb = cb;
+    e->userdata = userdata;
+    if (watch_add(&e->w, pulse_epoll_flags(events)) < 0) {
+        warn("Failed to watch pulse fd %d", fd);
+    }
+    e->next = pulse_ios;
+    pulse_ios = e;
+
+    return e;
+}
+
+static void
+pulse_io_enable(pa_io_event *e, pa_io_event_flags_t events)
+{
+    watch_mod(&e->w, pulse_epoll_flags(events));
+}
+
+static void
+pulse_io_free(pa_io_event *e)
+{
+    watch_del(&e->w);
+    e->dead = 1;
+}
+
+static void
+pulse_io_set_destroy(pa_io_event *e, pa_io_event_destroy_cb_t cb)
+{
+    e->destroy = cb;
+}
+
+static unsigned long
+pulse_tv_ms(const struct timeval *tv)
+{
+    struct timeval now;
+    long long usec;
+
+    if (tv->tv_usec & PULSE_TIMEVAL_RTCLOCK) {
+        return tv->tv_sec * 1000 + ((tv->tv_usec & ~PULSE_TIMEVAL_RTCLOCK) + 999) / 1000;
+    }
+
+    /* wall clock time, make it relative to the monotonic clock */
+    gettimeofday(&now, NULL);
+    usec = (tv->tv_sec - now.tv_sec) * 1000000LL + (tv->tv_usec - now.tv_usec);
+    return now_ms() + (usec > 0 ? (usec + 999) / 1000 : 0);
+}
+
+static void
+pulse_time_restart(pa_time_event *e, const struct timeval *tv)
+{
+    if (tv) {
+        e->tv = *tv;
+        e->deadline = pulse_tv_ms(tv);
+    } else {
+        e->deadline = ULONG_MAX;
+    }
+}
+
+static pa_time_event *
+pulse_time_new(pa_mainloop_api *a, const struct timeval *tv,
+        pa_time_event_cb_t cb, void *userdata)
+{
+    pa_time_event *e = calloc(1, sizeof(*e));
+
+    e->cb = cb;
+    e->userdata = userdata;
+    pulse_time_restart(e, tv);
+    e->next = pulse_times;
+    pulse_times = e;
+
+    return e;
+}
+
+static void
+pulse_time_free(pa_time_event *e)
+{
+    e->dead = 1;
+}
+
+static void
+pulse_time_set_destroy(pa_time_event *e, pa_time_event_destroy_cb_t cb)
+{
+    e->destroy = cb;
+}
+
+static pa_defer_event *
+pulse_defer_new(pa_mainloop_api *a, pa_defer_event_cb_t cb, void *userdata)
+{
+    pa_defer_event *e = calloc(1, sizeof(*e));
+
+    e->enabled = 1;
+    e->cb = cb;
+    e->userdata = userdata;
+    e->next = pulse_defers;
+    pulse_defers = e;
+
+    return e;
+}
+
+static void
+pulse_defer_enable(pa_defer_event *e, int b)
+{
+    e->enabled = b;
+}
+
+static void
+pulse_defer_free(pa_defer_event *e)
+{
+    e->dead = 1;
+}
+
+static void
+pulse_defer_set_destroy(pa_defer_event *e, pa_defer_event_destroy_cb_t cb)
+{
+    e->destroy = cb;
+}
+
+static void
+pulse_quit(pa_mainloop_api *a, int retval)
+{
+}
+
+static pa_mainloop_api pulse_api = {
+    .io_new            = pulse_io_new,
+    .io_enable         = pulse_io_enable,
+    .io_free           = pulse_io_free,
+    .io_set_destroy    = pulse_io_set_destroy,
+    .time_new          = pulse_time_new,
+    .time_restart      = pulse_time_restart,
+    .time_free         = pulse_time_free,
+    .time_set_destroy  = pulse_time_set_destroy,
+    .defer_new         = pulse_defer_new,
+    .defer_enable      = pulse_defer_enable,
+    .defer_free        = pulse_defer_free,
+    .defer_set_destroy = pulse_defer_set_destroy,
+    .quit              = pulse_quit,
+};
+
+static unsigned long
+pulse_deadline(void)
+{
+    pa_time_event *t;
+    pa_defer_event *d;
+    unsigned long deadline = ULONG_MAX;
+
+    for (d = pulse_defers; d; d = d->next) {
+        if (d->enabled && !d->dead) {
+            return 0;
+        }
+    }
+    for (t = pulse_times; t; t = t->next) {
+        if (!t->dead && t->deadline < deadline) {
+            deadline = t->deadline;
+        }
+    }
+
+    return deadline;
+}
+
+static void
+pulse_dispatch(unsigned long now)
+{
+    pa_io_event *io, **pio;
+    pa_time_event *t, **pt;
+    pa_defer_event *d, **pd;
+
+    for (d = pulse_defers; d; d = d->next) {
+        if (d->enabled && !d->dead) {
+            d->cb(&pulse_api, d, d->userdata);
+        }
+    }
+    for (t = pulse_times; t; t = t->next) {
+        if (!t->dead && t->deadline <= now) {
+            t->deadline = ULONG_MAX;
+            t->cb(&pulse_api, t, &t->tv, t->userdata);
+        }
+    }
+
+    /* events freed from callbacks are only released here */
+    for (pio = &pulse_ios; (io = *pio);) {
+        if (io->dead) {
+            *pio = io->next;
+            if (io->destroy) {
+                io->destroy(&pulse_api, io, io->userdata);
+            }
+            free(io);
+        } else {
+            pio = &io->next;
+        }
+    }
+    for (pt = &pulse_times; (t = *pt);) {
+        if (t->dead) {
+            *pt = t->next;
+            if (t->destroy) {
+                t->destroy(&pulse_api, t, t->userdata);
+            }
+            free(t);
+        } else {
+            pt = &t->next;
+        }
+    }
+    for (pd = &pulse_defers; (d = *pd);) {
+        if (d->dead) {
+            *pd = d->next;
+            if (d->destroy) {
+                d->destroy(&pulse_api, d, d->userdata);
+            }
+            free(d);
+        } else {
+            pd = &d->next;
+        }
+    }
+}
+#endif
+
+/* /proc/net/dev is read once per cycle into a table of every
+ * interface's counters, "all" sums up everything but loopback */
+#define NETDEV_MAX 128
+
+enum {
+    NET_RX, NET_RX_PACKETS, NET_RX_ERRS, NET_RX_DROP,
+    NET_TX, NET_TX_PACKETS, NET_TX_ERRS, NET_TX_DROP,
+    NET_COUNTERS
+};
+
+static struct netdev {
+    char name[IFNAMSIZ];
+    unsigned long long c[NET_COUNTERS];
+} netdev[NETDEV_MAX + 1]; /* last one is "all" */
+static int netdev_len;
+static unsigned long netdev_cycle;
+static struct timespec netdev_ts;
+
+static struct netdev *
+netdev_read(const char *iface)
+{
+    static char *buf;
+    static size_t size = 32768;
+    static int full_warned;
+    char *line;
+    struct netdev d, *all = &netdev[NETDEV_MAX];
+    int i;
+
+    if (netdev_cycle != cycle) {
+        /* hosts with lots of veth interfaces outgrow any fixed buffer */
+        if (readfile_grow("/proc/net/dev", &buf, &size) < 0) {
+            warn("Failed to open file /proc/net/dev");
+            return NULL;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &netdev_ts);
+        netdev_cycle = cycle;
+
+        memset(all, 0, sizeof(*all));
+        snprintf(all->name, sizeof(all->name), "all");
+        netdev_len = 0;
+        /* skip the two header lines */
+        for (line = strchr(buf, '\n'); line && (line = strchr(line + 1, '\n'));) {
+            if (sscanf(line, " %15[^:]: %llu %llu %llu %llu %*u %*u %*u %*u %llu %llu %llu %llu",
+                        d.name, &d.c[NET_RX], &d.c[NET_RX_PACKETS], &d.c[NET_RX_ERRS],
+                        &d.c[NET_RX_DROP], &d.c[NET_TX], &d.c[NET_TX_PACKETS],
+                        &d.c[NET_TX_ERRS], &d.c[NET_TX_DROP]) != 9) {
+                continue;
+            }
+            if (strcmp(d.name, "lo")) {
+                for (i = 0; i < NET_COUNTERS; i++) {
+                    all->c[i] += d.c[i];
+                }
+            }
+            if (netdev_len < NETDEV_MAX) {
+                netdev[netdev_len++] = d;
+            } else if (!full_warned) {
+                /* still counted in "all" */
+                warnx("More than %d network interfaces, not tracking %s on their own",
+                        NETDEV_MAX, d.name);
+                full_warned = 1;
+            }
+        }
+    }
+
+    if (!strcmp(iface, "all")) {
+        return all;
+    }
+    for (i = 0; i < netdev_len; i++) {
+        if (!strcmp(netdev[i].name, iface)) {
+            return &netdev[i];
+        }
+    }
+    warnx("No such network interface %s", iface);
+
+    return NULL;
+}
+
+/* previous counters of every interface net_* functions are used on,
+ * rates are taken over the real time passed between two samples, once
+ * per cycle and shared by every entry on the same counter */
+#define NET_IFACES_MAX 16
+
+static struct {
+    char name[IFNAMSIZ];
+    unsigned long cycle[NET_COUNTERS];
+    int primed[NET_COUNTERS];
+    unsigned long long c[NET_COUNTERS];
+    struct timespec ts[NET_COUNTERS];
+    double rate[NET_COUNTERS];
+} net_ifaces[NET_IFACES_MAX];
+static int net_ifaces_len;
+
+static double
+net_rate(const char *iface, int counter)
+{
+    int i;
+    struct netdev *d;
+    double dt, rate;
+
+    for (i = 0; i < net_ifaces_len && strcmp(net_ifaces[i].name, iface); i++);
+    if (i == NET_IFACES_MAX) {
+        warnx("Too many interfaces, not tracking %s", iface);
+        return -1;
+    } else if (i == net_ifaces_len) {
+        snprintf(net_ifaces[i].name, sizeof(net_ifaces[i].name), "%s", iface);
+        net_ifaces_len++;
+    }
+    if (net_ifaces[i].cycle[counter] == cycle) {
+        return net_ifaces[i].rate[counter];
+    }
+
+    if (!(d = netdev_read(iface))) {
+        net_ifaces[i].primed[counter] = 0;
+        return -1;
+    }
+    net_ifaces[i].cycle[counter] = cycle;
+
+    if (net_ifaces[i].primed[counter]) {
+        dt = (netdev_ts.tv_sec - net_ifaces[i].ts[counter].tv_sec)
+            + (netdev_ts.tv_nsec - net_ifaces[i].ts[counter].tv_nsec) / 1e9;
+        /* counters going backwards means the interface was reset */
+        rate = dt > 0 && d->c[counter] >= net_ifaces[i].c[counter]
+            ? (d->c[counter] - net_ifaces[i].c[counter]) / dt : 0;
+        if (NET_SMOOTHING > 0) {
+            /* ewma, weighted by how much time passed */
+            rate = net_ifaces[i].rate[counter] + (rate - net_ifaces[i].rate[counter])
+                * (dt * 1000 / (NET_SMOOTHING + dt * 1000));
+        }
+        net_ifaces[i].rate[counter] = rate;
+    }
+    net_ifaces[i].primed[counter] = 1;
+    net_ifaces[i].c[counter] = d->c[counter];
+    net_ifaces[i].ts[counter] = netdev_ts;
+
+    return net_ifaces[i].rate[counter];
+}
+
+static char *
+net_drops(const char *iface, char *out, size_t outlen)
+{
+    struct netdev *d;
+
+    if (!(d = netdev_read(iface))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%llu/%llu", d->c[NET_RX_DROP], d->c[NET_TX_DROP]);
+}
+
+static char *
+net_errs(const char *iface, char *out, size_t outlen)
+{
+    struct netdev *d;
+
+    if (!(d = netdev_read(iface))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%llu/%llu", d->c[NET_RX_ERRS], d->c[NET_TX_ERRS]);
+}
+
+static char *
+net_pkts(const char *iface, char *out, size_t outlen)
+{
+    double rx, tx;
+
+    if ((rx = net_rate(iface, NET_RX_PACKETS)) < 0
+            || (tx = net_rate(iface, NET_TX_PACKETS)) < 0) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%.0f/%.0f", rx, tx);
+}
+
+static char *
+net_up(const char *iface, char *out, size_t outlen)
+{
+    double tx_val;
+
+    if ((tx_val = net_rate(iface, NET_TX)) < 0) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    if (tx_val < 1000) {
+        RETURN_FORMAT("%-4.3g B/s", tx_val);
+    } else if (tx_val < 1000000) {
+        RETURN_FORMAT("%-4.3gKB/s", tx_val/1000.0);
+    } else if (tx_val < 1000000000){
+        RETURN_FORMAT("%-4.3gMB/s", tx_val/1000000.0);
+    } else {
+        RETURN_FORMAT("%-4.3gGB/s", tx_val/1000000000.0);
+	}
+}
+
+static char *
+net_down(const char *iface, char *out, size_t outlen)
+{
+    double rx_val;
+
+    if ((rx_val = net_rate(iface, NET_RX)) < 0) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    if (rx_val < 1000) {
+        RETURN_FORMAT("%-4.3g B/s", rx_val);
+    } else if (rx_val < 1000000) {
+        RETURN_FORMAT("%-4.3gKB/s", rx_val/1000.0);
+    } else if (rx_val < 1000000000){
+        RETURN_FORMAT("%-4.3gMB/s", rx_val/1000000.0);
+    } else {
+        RETURN_FORMAT("%-4.3gGB/s", rx_val/1000000000.0);
+	}
+}
+
+/* wifi comes from nl80211 over one generic netlink socket, the ssid
+ * and frequency are only queried again after connect/disconnect
+ * events, station info (signal, bitrates) at most once per cycle.
+ * requests never wait for their answer, the replies come in through
+ * the watch and wake the modules, which show the last values meanwhile */
+#define WIFI_IFACES_MAX 4
+
+#define NLA_OK(nla, len)   ((len) >= (int)NLA_HDRLEN && (nla)->nla_len >= NLA_HDRLEN \
+                            && (nla)->nla_len <= (len))
+#define NLA_NEXT(nla, len) ((len) -= NLA_ALIGN((nla)->nla_len), \
+                            (struct nlattr *)((char *)(nla) + NLA_ALIGN((nla)->nla_len)))
+#define NLA_DATA(nla)      ((void *)((char *)(nla) + NLA_HDRLEN))
+#define NLA_LEN(nla)       ((int)(nla)->nla_len - NLA_HDRLEN)
+
+static struct wifi {
+    char name[IFNAMSIZ];
+    int index;
+    int stale; /* ssid and frequency need querying */
+    char ssid[33];
+    unsigned int freq; /* MHz */
+    unsigned long cycle; /* of the last station query */
+    int connected;
+    int seen; /* the access point showed up in the running dump */
+    int signal; /* dBm */
+    unsigned int txrate, rxrate; /* 100kbit/s */
+    unsigned int info_seq, station_seq; /* of the requests in flight, 0 for none */
+} wifi_ifaces[WIFI_IFACES_MAX];
+static int wifi_ifaces_len;
+
+static Watch nl80211 = { -1, NULL };
+static int nl80211_family;
+static unsigned int nl80211_family_seq; /* while the family is looked up */
+static unsigned int nl80211_mlme;
+static unsigned int nl80211_seq;
+
+static void
+nl80211_event(struct nlmsghdr *nh)
+{
+    struct genlmsghdr *g = NLMSG_DATA(nh);
+    struct nlattr *nla = (struct nlattr *)((char *)g + GENL_HDRLEN);
+    int len = nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    int i;
+
+    if (nh->nlmsg_type != nl80211_family || (g->cmd != NL80211_CMD_CONNECT
+                && g->cmd != NL80211_CMD_DISCONNECT && g->cmd != NL80211_CMD_ROAM
+                && g->cmd != NL80211_CMD_CH_SWITCH_NOTIFY)) {
+        return;
+    }
+    for (; NLA_OK(nla, len); nla = NLA_NEXT(nla, len)) {
+        if (nla->nla_type != NL80211_ATTR_IFINDEX) {
+            continue;
+        }
+        for (i = 0; i < wifi_ifaces_len; i++) {
+            if (wifi_ifaces[i].index == *(int *)NLA_DATA(nla)) {
+                wifi_ifaces[i].stale = 1;
+            }
+        }
+    }
+    wake(wifi_essid);
+    wake(wifi_freq);
+}
+
+static unsigned int
+nl80211_send(int family, int cmd, int flags, int attr, const void *data, int len)
+{
+    struct {
+        struct nlmsghdr nh;
+        struct genlmsghdr g;
+        char attrs[64];
+    } req = {
+        .nh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN),
+        .nh.nlmsg_type = family,
+        .nh.nlmsg_flags = NLM_F_REQUEST | flags,
+        .nh.nlmsg_seq = ++nl80211_seq,
+        .g.cmd = cmd,
+        .g.version = 1,
+    };
+    struct nlattr *nla = (struct nlattr *)req.attrs;
+
+    nla->nla_type = attr;
+    nla->nla_len = NLA_HDRLEN + len;
+    memcpy(NLA_DATA(nla), data, len);
+    req.nh.nlmsg_len += NLA_ALIGN(nla->nla_len);
+
+    return send(nl80211.fd, &req, req.nh.nlmsg_len, 0) < 0 ? 0 : req.nh.nlmsg_seq;
+}
+
+static unsigned int
+nl80211_resolve(void)
+{
+    return nl80211_send(GENL_ID_CTRL, CTRL_CMD_GETFAMILY, 0, CTRL_ATTR_FAMILY_NAME,
+            NL80211_GENL_NAME, sizeof(NL80211_GENL_NAME));
+}
+
+static void
+nl80211_lost(void)
+{
+    int i;
+
+    /* missed events or replies, query everything again */
+    for (i = 0; i < wifi_ifaces_len; i++) {
+        wifi_ifaces[i].stale = 1;
+        wifi_ifaces[i].cycle = 0;
+        wifi_ifaces[i].info_seq = wifi_ifaces[i].station_seq = 0;
+    }
+    if (nl80211_family_seq) {
+        nl80211_family_seq = nl80211_resolve();
+    }
+    wake(wifi_essid);
+    wake(wifi_freq);
+}
+
+/* hand one message of a reply to cb, 1 while more are to come,
+ * 0 once the reply is complete and -1 with errno on an error */
+static int
+nl80211_reply(struct nlmsghdr *nh, void (*cb)(struct nlattr *nla, int len, void *arg), void *arg)
+{
+    int err;
+
+    if (nh->nlmsg_type == NLMSG_ERROR) {
+        if ((err = ((struct nlmsgerr *)NLMSG_DATA(nh))->error)) {
+            errno = -err;
+            return -1;
+        }
+        return 0;
+    } else if (nh->nlmsg_type == NLMSG_DONE) {
+        return 0;
+    }
+    cb((struct nlattr *)((char *)NLMSG_DATA(nh) + GENL_HDRLEN),
+            nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), arg);
+
+    return nh->nlmsg_flags & NLM_F_MULTI ? 1 : 0;
+}
+
+static void
+nl80211_family_cb(struct nlattr *nla, int len, void *arg)
+{
+    struct nlattr *grp, *a;
+    int glen, alen;
+    const char *name;
+    unsigned int id;
+
+    for (; NLA_OK(nla, len); nla = NLA_NEXT(nla, len)) {
+        if (nla->nla_type == CTRL_ATTR_FAMILY_ID) {
+            nl80211_family = *(uint16_t *)NLA_DATA(nla);
+        } else if (nla->nla_type == CTRL_ATTR_MCAST_GROUPS) {
+            glen = NLA_LEN(nla);
+            for (grp = NLA_DATA(nla); NLA_OK(grp, glen); grp = NLA_NEXT(grp, glen)) {
+                name = NULL;
+                id = 0;
+                alen = NLA_LEN(grp);
+                for (a = NLA_DATA(grp); NLA_OK(a, alen); a = NLA_NEXT(a, alen)) {
+                    if (a->nla_type == CTRL_ATTR_MCAST_GRP_NAME) {
+                        name = NLA_DATA(a);
+                    } else if (a->nla_type == CTRL_ATTR_MCAST_GRP_ID) {
+                        id = *(uint32_t *)NLA_DATA(a);
+                    }
+                }
+                if (name && !strcmp(name, NL80211_MULTICAST_GROUP_MLME)) {
+                    nl80211_mlme = id;
+                }
+            }
+        }
+    }
+}
+
+static int
+nl80211_ready(int ret)
+{
+    nl80211_family_seq = 0;
+    if (ret < 0 || !nl80211_family) {
+        warn("Failed to open nl80211 socket");
+        watch_del(&nl80211);
+        close(nl80211.fd);
+        nl80211.fd = -1;
+        return -1;
+    }
+    if (nl80211_mlme && setsockopt(nl80211.fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+                &nl80211_mlme, sizeof(nl80211_mlme)) < 0) {
+        warn("Failed to subscribe to wifi events");
+    }
+    wake(wifi_bitrate);
+    wake(wifi_dbm);
+    wake(wifi_essid);
+    wake(wifi_freq);
+    wake(wifi_perc);
+
+    return 0;
+}
+
+static void
+wifi_iface_cb(struct nlattr *nla, int len, void *arg)
+{
+    struct wifi *w = arg;
+
+    /* attributes that are missing went away */
+    w->ssid[0] = '\0';
+    w->freq = 0;
+    for (; NLA_OK(nla, len); nla = NLA_NEXT(nla, len)) {
+        if (nla->nla_type == NL80211_ATTR_SSID) {
+            snprintf(w->ssid, sizeof(w->ssid), "%.*s", NLA_LEN(nla), (char *)NLA_DATA(nla));
+        } else if (nla->nla_type == NL80211_ATTR_WIPHY_FREQ) {
+            w->freq = *(uint32_t *)NLA_DATA(nla);
+        }
+    }
+}
+
+static unsigned int
+wifi_rate(struct nlattr *nla)
+{
+    int len = NLA_LEN(nla);
+    unsigned int rate = 0;
+
+    for (nla = NLA_DATA(nla); NLA_OK(nla, len); nla = NLA_NEXT(nla, len)) {
+        if (nla->nla_type == NL80211_RATE_INFO_BITRATE32) {
+            return *(uint32_t *)NLA_DATA(nla);
+        } else if (nla->nla_type == NL80211_RATE_INFO_BITRATE) {
+            rate = *(uint16_t *)NLA_DATA(nla);
+        }
+    }
+
+    return rate;
+}
+
+static void
+wifi_station_cb(struct nlattr *nla, int len, void *arg)
+{
+    struct wifi *w = arg;
+    int slen;
+
+    for (; NLA_OK(nla, len); nla = NLA_NEXT(nla, len)) {
+        if (nla->nla_type != NL80211_ATTR_STA_INFO) {
+            continue;
+        }
+        w->seen = 1;
+        slen = NLA_LEN(nla);
+        for (nla = NLA_DATA(nla); NLA_OK(nla, slen); nla = NLA_NEXT(nla, slen)) {
+            if (nla->nla_type == NL80211_STA_INFO_SIGNAL) {
+                w->signal = *(int8_t *)NLA_DATA(nla);
+            } else if (nla->nla_type == NL80211_STA_INFO_TX_BITRATE) {
+                w->txrate = wifi_rate(nla);
+            } else if (nla->nla_type == NL80211_STA_INFO_RX_BITRATE) {
+                w->rxrate = wifi_rate(nla);
+            }
+        }
+        return;
+    }
+}
+
+static void
+wifi_reply(struct wifi *w, struct nlmsghdr *nh)
+{
+    int ret;
+
+    if (nh->nlmsg_seq == w->info_seq) {
+        if ((ret = nl80211_reply(nh, wifi_iface_cb, w)) > 0) {
+            return;
+        }
+        w->info_seq = 0;
+        if (ret < 0) {
+            /* interface gone, look it up again next time */
+            warn("Failed to get wifi info for %s", w->name);
+            w->index = 0;
+        }
+        wake(wifi_essid);
+        wake(wifi_freq);
+    } else if (nh->nlmsg_seq == w->station_seq) {
+        if ((ret = nl80211_reply(nh, wifi_station_cb, w)) > 0) {
+            return;
+        }
+        w->station_seq = 0;
+        w->connected = ret == 0 && w->seen;
+        if (ret < 0) {
+            warn("Failed to get wifi station for %s", w->name);
+            w->index = 0;
+        }
+        /* the woken entries run next cycle, this answer is for that one */
+        w->cycle = cycle + 1;
+        wake(wifi_bitrate);
+        wake(wifi_dbm);
+        wake(wifi_perc);
+    }
+}
+
+static void
+nl80211_cb(Watch *w, uint32_t events)
+{
+    char buf[8192];
+    struct nlmsghdr *nh;
+    ssize_t n;
+    int i, ret;
+
+    while ((n = recv(w->fd, buf, sizeof(buf), 0)) > 0 || (n < 0 && errno == ENOBUFS)) {
+        if (n < 0) {
+            nl80211_lost();
+            continue;
+        }
+        for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, n); nh = NLMSG_NEXT(nh, n)) {
+            if (!nh->nlmsg_seq) {
+                nl80211_event(nh);
+            } else if (nh->nlmsg_seq == nl80211_family_seq) {
+                if ((ret = nl80211_reply(nh, nl80211_family_cb, NULL)) <= 0
+                        && nl80211_ready(ret) < 0) {
+                    return;
+                }
+            } else {
+                for (i = 0; i < wifi_ifaces_len; i++) {
+                    wifi_reply(&wifi_ifaces[i], nh);
+                }
+            }
+        }
+    }
+}
+
+static int
+nl80211_init(void)
+{
+    struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+    nl80211.fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (nl80211.fd < 0 || bind(nl80211.fd, (struct sockaddr *)&sa, sizeof(sa)) < 0
+            || !(nl80211_family_seq = nl80211_resolve())) {
+        warn("Failed to open nl80211 socket");
+        if (nl80211.fd >= 0) {
+            close(nl80211.fd);
+            nl80211.fd = -1;
+        }
+        return -1;
+    }
+    nl80211.cb = nl80211_cb;
+    watch_add(&nl80211, EPOLLIN);
+
+    return 0;
+}
+
+static struct wifi *
+wifi_get(const char *iface)
+{
+    int i;
+
+    if (nl80211.fd < 0 && nl80211_init() < 0) {
+        return NULL;
+    }
+    if (!nl80211_family) {
+        /* still looking it up */
+        return NULL;
+    }
+
+    for (i = 0; i < wifi_ifaces_len && strcmp(wifi_ifaces[i].name, iface); i++);
+    if (i == WIFI_IFACES_MAX) {
+        warnx("Too many wifi interfaces, not tracking %s", iface);
+        return NULL;
+    } else if (i == wifi_ifaces_len) {
+        snprintf(wifi_ifaces[i].name, sizeof(wifi_ifaces[i].name), "%s", iface);
+        wifi_ifaces_len++;
+    }
+
+    if (!wifi_ifaces[i].index) {
+        if (!(wifi_ifaces[i].index = if_nametoindex(iface))) {
+            warn("No such wifi interface %s", iface);
+            return NULL;
+        }
+        wifi_ifaces[i].stale = 1;
+        wifi_ifaces[i].cycle = 0;
+    }
+
+    return &wifi_ifaces[i];
+}
+
+static struct wifi *
+wifi_info(const char *iface)
+{
+    struct wifi *w;
+
+    if (!(w = wifi_get(iface))) {
+        return NULL;
+    }
+    if (w->stale && !w->info_seq) {
+        if (!(w->info_seq = nl80211_send(nl80211_family, NL80211_CMD_GET_INTERFACE, 0,
+                        NL80211_ATTR_IFINDEX, &w->index, sizeof(w->index)))) {
+            warn("Failed to get wifi info for %s", iface);
+            return NULL;
+        }
+        w->stale = 0;
+    }
+
+    return w;
+}
+
+static struct wifi *
+wifi_station(const char *iface)
+{
+    struct wifi *w;
+
+    if (!(w = wifi_get(iface))) {
+        return NULL;
+    }
+    /* the access point is the only station in managed mode */
+    if (w->cycle != cycle && !w->station_seq) {
+        w->cycle = cycle;
+        w->seen = 0;
+        if (!(w->station_seq = nl80211_send(nl80211_family, NL80211_CMD_GET_STATION,
+                        NLM_F_DUMP, NL80211_ATTR_IFINDEX, &w->index, sizeof(w->index)))) {
+            warn("Failed to get wifi station for %s", iface);
+            return NULL;
+        }
+    }
+
+    return w->connected ? w : NULL;
+}
+
+static char *
+wifi_bitrate(const char *iface, char *out, size_t outlen)
+{
+    struct wifi *w;
+
+    if (!(w = wifi_station(iface))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%u/%uMbit/s", w->txrate / 10, w->rxrate / 10);
+}
+
+static char *
+wifi_dbm(const char *iface, char *out, size_t outlen)
+{
+    struct wifi *w;
+
+    if (!(w = wifi_station(iface))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%ddBm", w->signal);
+}
+
+static char *
+wifi_essid(const char *iface, char *out, size_t outlen)
+{
+    struct wifi *w;
+
+    if (!(w = wifi_info(iface)) || !w->ssid[0]) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%s", w->ssid);
+}
+
+static char *
+wifi_freq(const char *iface, char *out, size_t outlen)
+{
+    struct wifi *w;
+
+    if (!(w = wifi_info(iface)) || !w->freq) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    RETURN_FORMAT("%uMHz", w->freq);
+}
+
+static char *
+wifi_perc(const char *iface, char *out, size_t outlen)
+{
+    struct wifi *w;
+    int perc;
+
+    if (!(w = wifi_station(iface))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+    /* -100dBm and below is 0%, -50dBm and above 100% */
+    perc = MIN(MAX(2 * (w->signal + 100), 0), 100);
+
+    RETURN_FORMAT("%d%%", perc);
+}
+
+/* history of a few metrics, each sample taken when an entry on it is
+ * sampled, at most once per cycle, kept as 16 bit values in a ring,
+ * percentages linearly and rates on a log2 scale so one ring covers
+ * anything from bytes to gigabytes per second */
+#define HISTS_MAX 8
+#define HIST_LOG  2048.0 /* steps per doubling, up to 2^32 */
+
+static double
+hist_cpu(const char *unused)
+{
+    return cpustat_read() < 0 ? -1 : cpustat_busy(0);
+}
+
+static double
+hist_ram(const char *unused)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read()) || !mi->total) {
+        return -1;
+    }
+
+    return 100.0 * ((mi->total - mi->free) - (mi->buffers + mi->cached)) / mi->total;
+}
+
+static double
+hist_swap(const char *unused)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read()) || !mi->swaptotal) {
+        return -1;
+    }
+
+    return 100.0 * (mi->swaptotal - mi->swapfree - mi->swapcached) / mi->swaptotal;
+}
+
+/* net_rate takes each rate once per cycle, so a history sampling the
+ * same interface as net_down or net_up leaves their deltas alone */
+static double
+hist_rx(const char *iface)
+{
+    return net_rate(iface, NET_RX);
+}
+
+static double
+hist_tx(const char *iface)
+{
+    return net_rate(iface, NET_TX);
+}
+
+static double
+hist_io(const char *dev)
+{
+    struct disk *d;
+
+    if (!(d = disk_delta(dev))) {
+        return -1;
+    }
+
+    return d->dt > 0 ? MIN(100 * d->delta[DISK_IO_MS] / (d->dt * 1000), 100) : 0;
+}
+
+static const struct {
+    const char *name;
+    double (*sample)(const char *arg);
+    int rate; /* unbounded, kept on the log scale */
+} hist_metrics[] = {
+    { "cpu",  hist_cpu,  0 },
+    { "io",   hist_io,   0 },
+    { "ram",  hist_ram,  0 },
+    { "rx",   hist_rx,   1 },
+    { "swap", hist_swap, 0 },
+    { "tx",   hist_tx,   1 },
+};
+
+static struct hist {
+    const char *arg;
+    char sub[64]; /* argument of the metric itself */
+    int metric;
+    unsigned long cycle;
+    uint16_t ring[HIST_SAMPLES];
+    int head, len;
+} hists[HISTS_MAX];
+static int hists_len;
+
+static uint16_t
+hist_encode(const struct hist *h, double v)
+{
+    if (hist_metrics[h->metric].rate) {
+        return MIN(log2(1 + v) * HIST_LOG, UINT16_MAX);
+    }
+
+    return MIN(v, 100) * UINT16_MAX / 100;
+}
+
+static double
+hist_decode(const struct hist *h, uint16_t q)
+{
+    if (hist_metrics[h->metric].rate) {
+        return exp2(q / HIST_LOG) - 1;
+    }
+
+    return q * 100.0 / UINT16_MAX;
+}
+
+/* metric is a name from hist_metrics, followed by its argument for
+ * the ones that take one, e.g. "rx wlp3s0" */
+static struct hist *
+hist_sample(const char *metric)
+{
+    struct hist *h;
+    size_t n;
+    double v;
+    int i;
+
+    for (i = 0; i < hists_len && hists[i].arg != metric; i++);
+    if (i == HISTS_MAX) {
+        warnx("Too many histories, not tracking %s", metric);
+        return NULL;
+    } else if (i == hists_len) {
+        n = strcspn(metric, " ");
+        for (hists[i].metric = 0; hists[i].metric < (int)LEN(hist_metrics)
+                && (strncmp(hist_metrics[hists[i].metric].name, metric, n)
+                    || hist_metrics[hists[i].metric].name[n]); hists[i].metric++);
+        if (hists[i].metric == LEN(hist_metrics)) {
+            warnx("No such metric %s", metric);
+            return NULL;
+        }
+        snprintf(hists[i].sub, sizeof(hists[i].sub), "%s", metric + n + strspn(metric + n, " "));
+        hists[i].arg = metric;
+        hists_len++;
+    }
+    h = &hists[i];
+
+    if (h->cycle != cycle) {
+        h->cycle = cycle;
+        if ((v = hist_metrics[h->metric].sample(h->sub)) < 0) {
+            return NULL;
+        }
+        h->ring[(h->head + h->len) % HIST_SAMPLES] = hist_encode(h, v);
+        if (h->len < HIST_SAMPLES) {
+            h->len++;
+        } else {
+            h->head = (h->head + 1) % HIST_SAMPLES;
+        }
+    }
+
+    return h->len ? h : NULL;
+}
+
+static char *
+hist_spark(const char *metric, char *out, size_t outlen)
+{
+    static const char *bars = HIST_BARS;
+    const char *bar[17];
+    struct hist *h;
+    size_t len = 0;
+    double v, max = 100;
+    int i, j, n = 0, start;
+
+    if (!(h = hist_sample(metric))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    /* HIST_BARS is split into up to 16 utf-8 characters, lowest first,
+     * each one ends where the next starts */
+    for (i = 0; n < (int)LEN(bar); i++) {
+        if (!bars[i] || (bars[i] & 0xc0) != 0x80) {
+            bar[n++] = &bars[i];
+        }
+        if (!bars[i]) {
+            break;
+        }
+    }
+    n--;
+    start = MAX(h->len - HIST_WIDTH, 0);
+    /* rates are scaled to the highest one shown */
+    if (hist_metrics[h->metric].rate) {
+        for (i = start, max = 0; i < h->len; i++) {
+            max = MAX(max, hist_decode(h, h->ring[(h->head + i) % HIST_SAMPLES]));
+        }
+    }
+
+    out[0] = '\0';
+    for (i = start; i < h->len && n > 0; i++) {
+        v = hist_decode(h, h->ring[(h->head + i) % HIST_SAMPLES]);
+        j = max > 0 ? MIN((int)(v / max * n), n - 1) : 0;
+        len += snprintf(out + len, len < outlen ? outlen - len : 0, "%.*s",
+                (int)(bar[j + 1] - bar[j]), bar[j]);
+    }
+
+    return out;
+}
+
+static void
+hist_format(const struct hist *h, double v, char *buf, size_t len)
+{
+    if (!hist_metrics[h->metric].rate) {
+        snprintf(buf, len, "%.0f", v);
+    } else if (v < 1000) {
+        snprintf(buf, len, "%.3gB", v);
+    } else if (v < 1000000) {
+        snprintf(buf, len, "%.3gK", v / 1000);
+    } else if (v < 1000000000) {
+        snprintf(buf, len, "%.3gM", v / 1000000);
+    } else {
+        snprintf(buf, len, "%.3gG", v / 1000000000);
+    }
+}
+
+static char *
+hist_stats(const char *metric, char *out, size_t outlen)
+{
+    struct hist *h;
+    char min_str[16], avg_str[16], max_str[16];
+    double v, min = INFINITY, max = 0, sum = 0;
+    int i;
+
+    if (!(h = hist_sample(metric))) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
+
+    for (i = 0; i < h->len; i++) {
+        v = hist_decode(h, h->ring[(h->head + i) % HIST_SAMPLES]);
+        min = MIN(min, v);
+        max = MAX(max, v);
+        sum += v;
+    }
+    hist_format(h, min, min_str, sizeof(min_str));
+    hist_format(h, sum / h->len, avg_str, sizeof(avg_str));
+    hist_format(h, max, max_str, sizeof(max_str));
+
+    RETURN_FORMAT("%s/%s/%s%s", min_str, avg_str, max_str,
+            hist_metrics[h->metric].rate ? "/s" : "%");
+}
+
+static char *
+zswap_stored(const char *unused, char *out, size_t outlen)
+{
+    struct meminfo *mi;
+
+    if (!(mi = meminfo_read())) {
+        RETURN_FORMAT(UNKNOWN_STR);
+    }
 
-    RETURN_FORMAT(20, "%dh %dm", h, m);
+    RETURN_FORMAT("%f", (float)mi->zswapped / 1024 / 1024);
 }
 
 static char *
-username(void)
+zswap_used(const char *unused, char *out, size_t outlen)
 {
-    uid_t uid = geteuid();
-    struct passwd *pw = getpwuid(uid);
+    struct meminfo *mi;
 
-    if (pw == NULL) {
-        warn("Failed to get username");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (!(mi = meminfo_read())) {
+        RETURN_FORMAT(UNKNOWN_STR);
     }
 
-    RETURN_FORMAT(256, "%s", pw->pw_name);
+    RETURN_FORMAT("%f", (float)mi->zswap / 1024 / 1024);
 }
 
-static char *
-uid(void)
+static unsigned long
+now_ms(void)
 {
-    RETURN_FORMAT(10, "%d", geteuid());
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-#ifndef PULSE
-static char *
-vol_perc_alsa(const char *card)
+/* time spent in every entry, bucket n of the histogram
+ * counts calls that took less than 2^n microseconds */
+#define PROF_BUCKETS 32
+
+static struct {
+    unsigned long count;
+    unsigned long overruns;
+    unsigned long long min, max; /* ns */
+    unsigned long hist[PROF_BUCKETS];
+} prof[LEN(modules)];
+static int prof_exit;
+
+static void
+prof_add(size_t i, unsigned long long ns)
 {
-    int mute;
-    long int vol, max, min;
-    uint16_t vol_perc;
-    snd_mixer_t *handle;
-    snd_mixer_elem_t *elem;
-    snd_mixer_selem_id_t *s_elem;
+    unsigned long long us = ns / 1000;
+    int b = 0;
 
-    snd_mixer_open(&handle, 0);
-    snd_mixer_attach(handle, card);
-    snd_mixer_selem_register(handle, NULL, NULL);
-    snd_mixer_load(handle);
-    snd_mixer_selem_id_malloc(&s_elem);
-    snd_mixer_selem_id_set_name(s_elem, "Master");
-    elem = snd_mixer_find_selem(handle, s_elem);
+    while (us && b < PROF_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    prof[i].hist[b]++;
+    if (!prof[i].count++ || ns < prof[i].min) {
+        prof[i].min = ns;
+    }
+    if (ns > prof[i].max) {
+        prof[i].max = ns;
+    }
+}
+
+static double
+prof_quantile(size_t i, double q)
+{
+    unsigned long n = 0;
+    int b;
 
-    if (elem == NULL) {
-        snd_mixer_selem_id_free(s_elem);
-        snd_mixer_close(handle);
-        warn("Failed to get volume percentage for %s", card);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    /* upper bound of the bucket the quantile falls in */
+    for (b = 0; b < PROF_BUCKETS; b++) {
+        if ((n += prof[i].hist[b]) >= q * prof[i].count) {
+            break;
+        }
     }
 
-    snd_mixer_handle_events(handle);
-    snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
-    snd_mixer_selem_get_playback_volume(elem, 0, &vol);
-    snd_mixer_selem_get_playback_switch(elem, 0, &mute);
+    return MIN((double)(1ULL << b), prof[i].max / 1000.0);
+}
 
-    snd_mixer_selem_id_free(s_elem);
-    snd_mixer_close(handle);
+static void
+prof_name(size_t i, char *buf, size_t len)
+{
+    /* function names aren't kept around,
+     * pick them out of the stringified STATUS_CONTENT */
+    #define STR_(...) #__VA_ARGS__
+    #define STR(...) STR_(__VA_ARGS__)
+    const char *p = STR(STATUS_CONTENT);
+    size_t n = 0;
+
+    for (; *p; p++) {
+        if (*p == '"') {
+            for (p++; *p && *p != '"'; p += *p == '\\' ? 2 : 1);
+        } else if (*p == '{' && n++ == i) {
+            break;
+        }
+    }
+    p += strspn(p, "{ ");
+    snprintf(buf, len, "%.*s", (int)strcspn(p, " ,}"), p);
+}
 
-    vol_perc = ((uint16_t)(vol * 100) / max);
-    if (!mute) {
-        RETURN_FORMAT(20, VOL_MUTE_STR);
-    } else if (max == 0 || vol_perc == 0) {
-        RETURN_FORMAT(20, VOL_ZERO_STR);
-    } else {
-        RETURN_FORMAT(20, VOL_STR, vol_perc);
+static void
+prof_dump(void)
+{
+    size_t i;
+    char name[32];
+
+    fprintf(stderr, "%-20s %-16s %8s %10s %10s %10s %10s %8s\n",
+            "function", "argument", "calls", "min us", "p50 us", "p99 us", "max us", "overruns");
+    for (i = 0; i < LEN(modules); i++) {
+        prof_name(i, name, sizeof(name));
+        fprintf(stderr, "%-20s %-16.16s %8lu %10.1f %10.1f %10.1f %10.1f %8lu\n",
+                name, modules[i].arg ? modules[i].arg : "",
+                prof[i].count, prof[i].min / 1000.0,
+                prof_quantile(i, 0.5), prof_quantile(i, 0.99),
+                prof[i].max / 1000.0, prof[i].overruns);
     }
 }
-#endif
 
-#ifdef PULSE
-static char *
-vol_perc_pulse(void)
+static unsigned long long
+bench_reads(void)
 {
-    RETURN_FORMAT(80, pulse_vol_str);
+    int fd;
+    char buf[256], *p;
+    ssize_t n;
+
+    /* read syscalls done so far, the real /proc rather than the fixture */
+    if ((fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC)) < 0) {
+        return 0;
+    }
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    buf[n > 0 ? n : 0] = '\0';
+
+    return (p = strstr(buf, "syscr: ")) ? strtoull(p + 7, NULL, 10) : 0;
 }
 
-static char *
-micvol_perc_pulse(void)
+static void
+bench(unsigned long n)
 {
-    RETURN_FORMAT(80, pulse_micvol_str);
+    struct timespec t0, t1;
+    unsigned long long r0, r1, overhead;
+    unsigned long k;
+    size_t i;
+    char name[32];
+
+    r0 = bench_reads();
+    overhead = bench_reads() - r0;
+
+    printf("%-20s %-16s %10s %10s\n", "function", "argument", "ns/call", "reads/call");
+    for (i = 0; i < LEN(modules); i++) {
+        /* once up front to get files opened and cached */
+        cycle++;
+        modules[i].func(modules[i].arg, arena[i], sizeof(arena[i]));
+
+        r0 = bench_reads();
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (k = 0; k < n; k++) {
+            /* skip the per-cycle caches, every call does the full work */
+            cycle++;
+            modules[i].func(modules[i].arg, arena[i], sizeof(arena[i]));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        r1 = bench_reads();
+
+        prof_name(i, name, sizeof(name));
+        printf("%-20s %-16.16s %10.0f %10.2f\n", name, modules[i].arg ? modules[i].arg : "",
+                ((t1.tv_sec - t0.tv_sec) * 1e9 + t1.tv_nsec - t0.tv_nsec) / n,
+                (double)(r1 - r0 - overhead) / n);
+    }
 }
 
-static char *
-pulse_profile(void)
+static void
+heap_down(size_t i)
 {
-    RETURN_FORMAT(80, pulse_profile_str);
+    size_t c, tmp;
+
+    while ((c = 2 * i + 1) < LEN(heap)) {
+        if (c + 1 < LEN(heap) && slots[heap[c + 1]].deadline < slots[heap[c]].deadline) {
+            c++;
+        }
+        if (slots[heap[i]].deadline <= slots[heap[c]].deadline) {
+            break;
+        }
+        tmp = heap[i];
+        heap[i] = heap[c];
+        heap[c] = tmp;
+        i = c;
+    }
 }
 
-static char *
-pulse_profile_icon(void)
+static void
+heap_up(size_t i)
 {
-    if (!strcmp(PULSE_HEADPHONE_STR, pulse_profile_str)) {
-        RETURN_FORMAT(80, PULSE_HEADPHONE_ICON);
-    } else if (!strcmp(PULSE_SPEAKER_STR, pulse_profile_str)) {
-        RETURN_FORMAT(80, PULSE_SPEAKER_ICON);
-    } else if (!strcmp(PULSE_HDMI_STR, pulse_profile_str)) {
-        RETURN_FORMAT(80, PULSE_HDMI_ICON);
+    size_t p, tmp;
+
+    while (i > 0 && slots[heap[i]].deadline < slots[heap[p = (i - 1) / 2]].deadline) {
+        tmp = heap[i];
+        heap[i] = heap[p];
+        heap[p] = tmp;
+        i = p;
     }
-    RETURN_FORMAT(10, UNKNOWN_STR);
 }
 
 static void
-pulse_context_state_cb(pa_context *c, void *userdata)
+wake(char *(*func)(const char *, char *, size_t))
 {
-    switch(pa_context_get_state(c)) {
-        case PA_CONTEXT_CONNECTING:
-        case PA_CONTEXT_AUTHORIZING:
-        case PA_CONTEXT_SETTING_NAME:
-            break;
-        case PA_CONTEXT_READY:; /* <- note the semi-colon, very important */
-            pa_context_set_subscribe_callback(c, pulse_volume_change_cb, NULL);
-            pa_operation_unref(pa_context_subscribe(c, PA_SUBSCRIPTION_MASK_SINK | PA_SUBSCRIPTION_MASK_SOURCE, NULL, NULL));
-            pa_operation_unref(pa_context_get_sink_info_list(c, pulse_sink_info_cb, NULL));
-            pa_operation_unref(pa_context_get_source_info_list(c, pulse_source_info_cb, NULL));
-            break;
-        default:
-            fprintf(stderr, "pulse connection failure: %s\n",
-                    pa_strerror(pa_context_errno(c)));
+    size_t i;
+
+    /* make every entry of func due now, for values that are pushed
+     * by events rather than polled */
+    for (i = 0; i < LEN(heap); i++) {
+        if (modules[heap[i]].func == func) {
+            slots[heap[i]].deadline = 0;
+            heap_up(i);
+        }
+    }
+}
 
-            sprintf(pulse_vol_str, UNKNOWN_STR);
-            sprintf(pulse_profile_str, UNKNOWN_STR);
-            pa_context_unref(c);
-            break;
+static void
+slot_store(size_t i, const char *val)
+{
+    if (strncmp(slots[i].val, val, sizeof(slots[i].val) - 1)) {
+        snprintf(slots[i].val, sizeof(slots[i].val), "%s", val);
+        slots[i].dirty = 1;
     }
 }
 
+/* a value written on one thread and read on another, a reader that
+ * races a write retries instead of either side taking a lock (seqlock),
+ * there must be only one writer at a time */
+typedef struct {
+    atomic_uint seq; /* odd while a write is in progress */
+    char val[VALUE_MAX];
+} Snapshot;
+
 static void
-pulse_sink_info_cb(pa_context *c, const pa_sink_info *sink_info, int eol, void *userdata)
+snapshot_write(Snapshot *s, const char *val)
 {
-    if (sink_info && strstr(sink_info->description, SINK_MATCH)) {
-        sprintf(pulse_profile_str, sink_info->name);
+    unsigned int seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
 
-        pa_volume_t vol = (int)(pa_cvolume_avg(&sink_info->volume) * 100.0 
-                / (sink_info->n_volume_steps-1) + .5);
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    snprintf(s->val, sizeof(s->val), "%s", val);
+    atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+}
 
-		if (!sink_info->n_volume_steps) {
-			vol = (int)(pa_cvolume_avg(&sink_info->volume) * 100.0 
-							/ (65500-1) + .5);
-		}
+static unsigned int
+snapshot_read(Snapshot *s, char *buf, size_t len)
+{
+    unsigned int seq;
 
-        if (sink_info->mute) {
-            sprintf(pulse_vol_str, VOL_MUTE_STR);
-        } else if (vol == 0) {
-            sprintf(pulse_vol_str, VOL_ZERO_STR "%%");
-        } else {
-            sprintf(pulse_vol_str, VOL_STR "%%", vol);
+    do {
+        while ((seq = atomic_load_explicit(&s->seq, memory_order_acquire)) & 1);
+        memcpy(buf, s->val, MIN(len, sizeof(s->val)));
+        atomic_thread_fence(memory_order_acquire);
+    } while (seq != atomic_load_explicit(&s->seq, memory_order_relaxed));
+    buf[MIN(len, sizeof(s->val)) - 1] = '\0';
+
+    return seq;
+}
+
+/* entries marked ASYNC are handed to a few worker threads, the main
+ * loop waits up to ASYNC_WAIT ms for them and otherwise keeps showing
+ * the previous value until they report back over an eventfd */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_todo = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_back;
+static size_t pool_queue[LEN(modules)], pool_head, pool_len;
+static Snapshot pool_values[LEN(modules)];
+static unsigned int pool_seen[LEN(modules)]; /* last seq picked up */
+static unsigned long pool_busy[LEN(modules)]; /* cycle it was handed out in */
+static unsigned long pool_cycle;
+static unsigned int pool_pending; /* handed out this cycle, not back yet */
+static Watch pool_watch = { -1, NULL };
+static int pool_async[LEN(modules)]; /* marked ASYNC and allowed to be */
+
+/* the only functions ASYNC is honoured for, they read their files
+ * one-off on a worker and share nothing but the locked mount table,
+ * the rest use per-cycle caches and tables the main loop owns */
+static char *(*const pool_safe[])(const char *, char *, size_t) = {
+    battery_perc_smapi, battery_state_smapi, battery_time_smapi,
+    cpu_freq, datetime, disk_free, disk_fullest, disk_perc, disk_total,
+    disk_used, entropy, fan_ibm, gid, hostname, load_avg, temp,
+    temp_workaround, uid, uptime,
+};
+
+static void *
+pool_worker(void *unused)
+{
+    size_t i;
+    char *val;
+    uint64_t one = 1;
+    struct timespec t0, t1;
+
+    readers_off = 1;
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (!pool_len) {
+            pthread_cond_wait(&pool_todo, &pool_lock);
+        }
+        i = pool_queue[pool_head];
+        pool_head = (pool_head + 1) % LEN(pool_queue);
+        pool_len--;
+        pthread_mutex_unlock(&pool_lock);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        val = modules[i].func(modules[i].arg, arena[i], sizeof(arena[i]));
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        snapshot_write(&pool_values[i], val);
+
+        pthread_mutex_lock(&pool_lock);
+        prof_add(i, (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec);
+        if (pool_busy[i] == pool_cycle && pool_pending) {
+            pool_pending--;
+            pthread_cond_signal(&pool_back);
+        }
+        pool_busy[i] = 0;
+        if (write(pool_watch.fd, &one, sizeof(one)) < 0) {
+            warn("Failed to signal the main loop");
         }
     }
+
+    return NULL;
 }
 
 static void
-pulse_source_info_cb(pa_context *c, const pa_source_info *source_info, int eol, void *userdata)
+pool_dispatch(size_t i)
 {
-    if (source_info && strstr(source_info->description, SOURCE_MATCH)) {
-        pa_volume_t vol = (int)(pa_cvolume_avg(&source_info->volume) * 100.0 
-                / (source_info->n_volume_steps-1) + .5);
-
-		if (!source_info->n_volume_steps) {
-			vol = (int)(pa_cvolume_avg(&source_info->volume) * 100.0 
-							/ (65500-1) + .5);
-		}
+    pthread_mutex_lock(&pool_lock);
+    if (pool_busy[i]) {
+        /* still stuck in the previous call */
+        prof[i].overruns++;
+    } else {
+        pool_busy[i] = pool_cycle = cycle;
+        pool_pending++;
+        pool_queue[(pool_head + pool_len++) % LEN(pool_queue)] = i;
+        pthread_cond_signal(&pool_todo);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
 
-        if (source_info->mute) {
-            sprintf(pulse_micvol_str, VOL_MUTE_STR);
-        } else if (vol == 0) {
-            sprintf(pulse_micvol_str, VOL_ZERO_STR "%%");
-        } else {
-            sprintf(pulse_micvol_str, VOL_STR "%%", vol);
+static void
+pool_collect(void)
+{
+    size_t i;
+    unsigned int seq;
+    char val[VALUE_MAX];
+
+    /* no lock, only entries whose value was published since last time */
+    for (i = 0; i < LEN(modules); i++) {
+        seq = atomic_load_explicit(&pool_values[i].seq, memory_order_acquire);
+        if (pool_async[i] && seq != pool_seen[i]) {
+            pool_seen[i] = snapshot_read(&pool_values[i], val, sizeof(val));
+            slot_store(i, val);
         }
     }
 }
 
 static void
-pulse_volume_change_cb(pa_context *c, pa_subscription_event_type_t t, 
-        uint32_t idx, void *userdata)
+pool_wait(unsigned long deadline)
 {
-    pa_operation_unref(pa_context_get_sink_info_list(c, pulse_sink_info_cb, NULL));
-    pa_operation_unref(pa_context_get_source_info_list(c, pulse_source_info_cb, NULL));
+    struct timespec ts = { deadline / 1000, deadline % 1000 * 1000000 };
+
+    pthread_mutex_lock(&pool_lock);
+    while (pool_pending && pthread_cond_timedwait(&pool_back, &pool_lock, &ts) != ETIMEDOUT);
+    pool_pending = 0;
+    pthread_mutex_unlock(&pool_lock);
+    pool_collect();
 }
-#endif
 
-static char *
-net_up(double *tx_old, const char *iface)
+static void
+pool_cb(Watch *w, uint32_t events)
 {
-    char path[50];
-    double tx_val, tx_buf = 0;
-    FILE *fp;
+    uint64_t n;
 
-    sprintf(path, "/sys/class/net/%s/statistics/tx_bytes", iface);
-    fp = fopen(path, "r");
-    if (fp == NULL) {
-        warn("Failed to open file %s", path);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    if (read(w->fd, &n, sizeof(n)) < 0 && errno != EAGAIN) {
+        warn("Failed to read from the worker threads");
+    }
+    pool_collect();
+}
+
+static void
+pool_init(void)
+{
+    pthread_condattr_t attr;
+    pthread_t t;
+    size_t i, j;
+    int n = 0;
+    char name[32];
+
+    for (i = 0; i < LEN(modules); i++) {
+        if (!(modules[i].interval & ASYNC_BIT)) {
+            continue;
+        }
+        for (j = 0; j < LEN(pool_safe) && pool_safe[j] != modules[i].func; j++);
+        if (j == LEN(pool_safe)) {
+            prof_name(i, name, sizeof(name));
+            warnx("%s can't run ASYNC, sampling it on the main thread", name);
+            continue;
+        }
+        pool_async[i] = 1;
+        /* no more threads than there are entries to run on them */
+        n++;
+    }
+    if (!(n = MIN(n, WORKERS))) {
+        return;
     }
-    fscanf(fp, "%lf", &tx_buf);
-    fclose(fp);
 
-    tx_val = tx_buf-*tx_old;
-    *tx_old = tx_buf;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool_back, &attr);
+    pthread_condattr_destroy(&attr);
 
-    if (tx_val < 1000) {
-        RETURN_FORMAT(20, "%-4.3g B/s", tx_val);
-    } else if (tx_val < 1000000) {
-        RETURN_FORMAT(20, "%-4.3gKB/s", tx_val/1000.0);
-    } else if (tx_val < 1000000000){
-        RETURN_FORMAT(20, "%-4.3gMB/s", tx_val/1000000.0);
-    } else {
-        RETURN_FORMAT(20, "%-4.3gGB/s", tx_val/1000000000.0);
-	}
+    if ((pool_watch.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        err(1, "Failed to set up worker threads");
+    }
+    pool_watch.cb = pool_cb;
+    watch_add(&pool_watch, EPOLLIN);
+    while (n--) {
+        if (pthread_create(&t, NULL, pool_worker, NULL)) {
+            err(1, "Failed to start worker thread");
+        }
+        pthread_detach(t);
+    }
 }
 
-static char *
-net_down(double *rx_old, const char *iface)
+static void
+schedule(unsigned long now)
 {
-    char path[50];
-    double rx_val, rx_buf = 0;
-    FILE *fp;
+    size_t i;
 
-    sprintf(path, "/sys/class/net/%s/statistics/rx_bytes", iface);
-    fp = fopen(path, "r");
-    if (fp == NULL) {
-        warn("Failed to open file %s", path);
-        RETURN_FORMAT(10, UNKNOWN_STR);
-    }
-    fscanf(fp, "%lf", &rx_buf);
-    fclose(fp);
+    /* resample every entry whose deadline passed, the
+     * others keep showing their last value */
+    struct timespec t0, t1;
 
-    rx_val = rx_buf-*rx_old;
-    *rx_old = rx_buf;
+    while (slots[heap[0]].deadline <= now) {
+        i = heap[0];
+        if (pool_async[i]) {
+            pool_dispatch(i);
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            slot_store(i, modules[i].func(modules[i].arg, arena[i], sizeof(arena[i])));
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            prof_add(i, (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec);
+        }
 
-    if (rx_val < 1000) {
-        RETURN_FORMAT(20, "%-4.3g B/s", rx_val);
-    } else if (rx_val < 1000000) {
-        RETURN_FORMAT(20, "%-4.3gKB/s", rx_val/1000.0);
-    } else if (rx_val < 1000000000){
-        RETURN_FORMAT(20, "%-4.3gMB/s", rx_val/1000000.0);
-    } else {
-        RETURN_FORMAT(20, "%-4.3gGB/s", rx_val/1000000000.0);
-	}
+        if (!INTERVAL(i)) {
+            slots[i].deadline = ULONG_MAX;
+        } else if (!slots[i].deadline) {
+            /* first sample or woken up early */
+            slots[i].deadline = now + INTERVAL(i);
+        } else if ((slots[i].deadline += INTERVAL(i)) <= now) {
+            /* fell behind, don't try to catch up */
+            slots[i].deadline = now + INTERVAL(i);
+            prof[i].overruns++;
+        }
+        heap_down(0);
+    }
 }
 
-static char *
-wifi_perc(void)
+static void
+slots_set(char *(*func)(const char *, char *, size_t), const char *arg, const char *val)
 {
-    int perc = -1;
-    FILE *fp;
+    size_t i;
 
-    fp = fopen("/proc/net/wireless", "r");
-    if (fp == NULL) {
-        warn("Failed to open file /proc/net/wireless");
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    /* values produced outside of schedule(), like command output */
+    for (i = 0; i < LEN(slots); i++) {
+        if (modules[i].func == func && (modules[i].arg == arg
+                    || (arg && modules[i].arg && !strcmp(modules[i].arg, arg)))) {
+            slot_store(i, val);
+        }
     }
+}
+
+/* STATUS_FORMAT compiled once at startup, literal text followed by
+ * the slot it's filled in with and that slot's width/precision */
+static struct {
+    const char *lit;
+    size_t litlen;
+    int slot; /* -1 for the trailing text */
+    int left;
+    size_t width, prec;
+    size_t pos; /* where it was rendered last time */
+} segs[LEN(modules) + 1];
+static size_t segs_len;
+static char tmpl_text[sizeof(STATUS_FORMAT)];
+
+static void
+tmpl_compile(void)
+{
+    const char *fmt = STATUS_FORMAT;
+    char *t = tmpl_text;
+    size_t speclen, i = 0;
+    int slot = 0;
+
+    segs[0].lit = t;
+    while (*fmt) {
+        if (*fmt != '%') {
+            *t++ = *fmt++;
+            continue;
+        } else if (fmt[1] == '%') {
+            *t++ = '%';
+            fmt += 2;
+            continue;
+        }
+
+        speclen = strspn(fmt + 1, "-0123456789.") + 2;
+        if (fmt[speclen - 1] != 's') {
+            *t++ = *fmt++;
+            continue;
+        } else if (slot == (int)LEN(slots)) {
+            warnx("More %%s in STATUS_FORMAT than entries in STATUS_CONTENT");
+            fmt += speclen;
+            continue;
+        }
 
-    /* there has to be a better way to accomplish this
-     * but it works */
-    fscanf(fp, "%*s %*s %*s %*s %*s %*s %*s %*s %*s %*s\n\
-            %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*d\n\
-            %*s %*d %d", &perc);
-    fclose(fp);
+        /* close the current literal on this slot */
+        segs[i].litlen = t - segs[i].lit;
+        segs[i].slot = slot++;
+        segs[i].left = fmt[1] == '-';
+        segs[i].width = strtoul(fmt + 1 + strspn(fmt + 1, "-0"), NULL, 10);
+        segs[i].prec = memchr(fmt, '.', speclen) ? strtoul(memchr(fmt, '.', speclen) + 1, NULL, 10) : VALUE_MAX;
+        /* keeps STATUS_MAX a bound on the whole status */
+        segs[i].width = MIN(segs[i].width, VALUE_MAX - 1);
+        segs[i].prec = MIN(segs[i].prec, VALUE_MAX - 1);
+        fmt += speclen;
+        segs[++i].lit = t;
+    }
+    segs[i].litlen = t - segs[i].lit;
+    segs[i].slot = -1;
+    segs_len = i + 1;
 
-    if (perc == -1) {
-        RETURN_FORMAT(10, UNKNOWN_STR);
-    } else  {
-        RETURN_FORMAT(5, "%d%%", perc);
+    for (i = 0; i < segs_len; i++) {
+        segs[i].pos = SIZE_MAX;
     }
 }
 
-static char *
-wifi_essid(const char *iface)
+static int
+render(char *buf, size_t len)
 {
-    char id[IW_ESSID_MAX_SIZE+1];
-    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    struct iwreq wreq;
+    size_t i, n = 0, vlen, pad;
+    const char *val;
+    int changed = 0;
+
+    /* everything up to the first slot that changed or moved is
+     * still in buf from last time, only copy from there on */
+    for (i = 0; i < segs_len; i++) {
+        if (segs[i].pos == n && (segs[i].slot < 0 || !slots[segs[i].slot].dirty)) {
+            n += segs[i].litlen;
+            if (segs[i].slot >= 0) {
+                vlen = strnlen(slots[segs[i].slot].val, segs[i].prec);
+                n += MAX(vlen, segs[i].width);
+            }
+            continue;
+        }
+        changed = 1;
+        segs[i].pos = n;
+
+        if (n + segs[i].litlen >= len) {
+            break;
+        }
+        memcpy(buf + n, segs[i].lit, segs[i].litlen);
+        n += segs[i].litlen;
+        if (segs[i].slot < 0) {
+            continue;
+        }
 
-    memset(&wreq, 0, sizeof(struct iwreq));
-    wreq.u.essid.length = IW_ESSID_MAX_SIZE+1;
-    sprintf(wreq.ifr_name, iface);
-    if (sockfd == -1) {
-        warn("Failed to get ESSID for interface %s", iface);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+        val = slots[segs[i].slot].val;
+        slots[segs[i].slot].dirty = 0;
+        vlen = strnlen(val, segs[i].prec);
+        pad = segs[i].width > vlen ? segs[i].width - vlen : 0;
+        if (n + vlen + pad >= len) {
+            break;
+        }
+        if (!segs[i].left) {
+            memset(buf + n, ' ', pad);
+            n += pad;
+        }
+        memcpy(buf + n, val, vlen);
+        n += vlen;
+        if (segs[i].left) {
+            memset(buf + n, ' ', pad);
+            n += pad;
+        }
     }
-    wreq.u.essid.pointer = id;
-    if (ioctl(sockfd,SIOCGIWESSID, &wreq) == -1) {
-        warn("Failed to get ESSID for interface %s", iface);
-        RETURN_FORMAT(10, UNKNOWN_STR);
+    buf[MIN(n, len - 1)] = '\0';
+
+    return changed;
+}
+
+/* the main loop sleeps in a single epoll_wait on these, a timerfd
+ * armed for the next deadline, a signalfd and whatever event sources
+ * (command output, pulse) registered themselves */
+static Watch timer = { -1, NULL };
+static Watch sigwatch = { -1, NULL };
+
+static int
+watch_add(Watch *w, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = w };
+
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, w->fd, &ev);
+}
+
+static int
+watch_mod(Watch *w, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = w };
+
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, w->fd, &ev);
+}
+
+static void
+watch_del(Watch *w)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, w->fd, NULL);
+}
+
+static void
+timer_cb(Watch *w, uint32_t events)
+{
+    uint64_t expirations;
+
+    read(w->fd, &expirations, sizeof(expirations));
+}
+
+static void
+timer_arm(unsigned long deadline)
+{
+    struct itimerspec its = { 0 };
+
+    if (deadline != ULONG_MAX) {
+        /* a zero it_value would disarm instead of firing right away */
+        its.it_value.tv_sec = deadline / 1000;
+        its.it_value.tv_nsec = (deadline % 1000) * 1000000 + 1;
     }
+    timerfd_settime(timer.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
 
-    close(sockfd);
+static void
+signal_cb(Watch *w, uint32_t events)
+{
+    struct signalfd_siginfo si;
 
-    if (!strcmp((char *)wreq.u.essid.pointer, "")) {
-        RETURN_FORMAT(10, UNKNOWN_STR);
-    } else {
-        RETURN_FORMAT(256, "%s", (char *)wreq.u.essid.pointer);
+    while (read(w->fd, &si, sizeof(si)) == sizeof(si)) {
+        if (si.ssi_signo == SIGTERM || si.ssi_signo == SIGINT) {
+            done = 1;
+        } else if (si.ssi_signo == SIGUSR1) {
+            prof_dump();
+        }
     }
 }
 
@@ -1061,41 +4752,54 @@ update_status(output dest, const char *str)
 {
     if (dest == XROOT) {
         XStoreName(display, DefaultRootWindow(display), str);
-        XSync(display, False);
+        XFlush(display);
     } else {
         printf("%s\n", str);
     }
 }
 
-static void
-sighandler(const int signo)
-{
-    if (signo == SIGTERM || signo == SIGINT) {
-        done = 1;
-    }
-}
-
 int
 main(int argc, char *argv[])
 {
     output dest = XROOT;
-    if (argc == 2 && !strcmp("-v", argv[1])) {
-        printf("sstat-%s\n", VERSION);
+    int daemonize = 0;
+    unsigned long bench_n = 0;
+    if (getenv("SSTAT_ROOT")) {
+        root = getenv("SSTAT_ROOT");
+    }
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp("-v", argv[i])) {
+            printf("sstat-%s\n", VERSION);
+            exit(0);
+        } else if (!strcmp("-d", argv[i])) {
+            daemonize = 1;
+        } else if (!strcmp("-o", argv[i])) {
+            dest = STDOUT;
+        } else if (!strcmp("-p", argv[i])) {
+            prof_exit = 1;
+        } else if (!strcmp("-b", argv[i]) && i + 1 < argc) {
+            bench_n = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp("-r", argv[i]) && i + 1 < argc) {
+            root = argv[++i];
+        } else {
+            fprintf(stderr, "usage: sstat [option]...\n"
+                    "options:\n"
+                    "  -b n run every function n times, print the time per call and exit\n"
+                    "  -d start daemonized\n"
+                    "  -o print status instead of setting it as rootwindow title\n"
+                    "  -p print time spent in every function on exit\n"
+                    "  -r dir read /proc, /sys and mountpoints relative to dir\n"
+                    "  -v print version info and exit\n"
+                    "  -h print this info and exit\n");
+            exit(1);
+        }
+    }
+    if (bench_n) {
+        bench(bench_n);
         exit(0);
-    } else if (argc == 2 && !strcmp("-d", argv[1])) {
-        if (daemon(1, 1) < 0) {
-            err(1, "daemon");
-        }
-    } else if (argc == 2 && !strcmp("-o", argv[1])) {
-        dest = STDOUT;
-    } else if (argc != 1) { 
-        fprintf(stderr, "usage: sstat [option]\n"
-                "options:\n"
-                "  -d start daemonized\n"
-                "  -o print status instead of setting it as rootwindow title\n"
-                "  -v print version info and exit\n"
-                "  -h print this info and exit\n");
-        exit(1);
+    }
+    if (daemonize && daemon(1, 1) < 0) {
+        err(1, "daemon");
     }
     if (dest == XROOT) {
         if (!(display = XOpenDisplay(NULL))) {
@@ -1104,57 +4808,76 @@ main(int argc, char *argv[])
         }
     }
 
-    /* init signal handling */
-    struct sigaction act;
-    memset(&act, 0, sizeof(act));
-    act.sa_handler = sighandler;
-    sigaction(SIGINT,  &act, 0);
-    sigaction(SIGTERM, &act, 0);
-
-    /* take care of variables that need to be
-     * kept between cycles */
-#define cpu_perc()          cpu_perc(ps_old)
-#define net_up(interface)   net_up(&tx_old, interface)
-#define net_down(interface) net_down(&rx_old, interface)
-    long double ps_old[4];
-    double rx_old, tx_old;
+    /* init the main loop's epoll set, signals are read
+     * from a signalfd instead of interrupting anything */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1); /* dump time spent in every function */
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0
+            || (timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0
+            || (sigwatch.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+        err(1, "Failed to set up main loop");
+    }
+    timer.cb = timer_cb;
+    sigwatch.cb = signal_cb;
+    watch_add(&timer, EPOLLIN);
+    watch_add(&sigwatch, EPOLLIN);
 
 #ifdef PULSE
-
     /* init pulseaudio */
-    pa_threaded_mainloop *m = pa_threaded_mainloop_new();
-    pa_threaded_mainloop_start(m);
-    assert(m);
-
-    pa_threaded_mainloop_lock(m);
-
-    pa_context *c = pa_context_new(pa_threaded_mainloop_get_api(m), "sstat_volmon");
-    pa_context_set_state_callback(c, pulse_context_state_cb, NULL);
-    pa_context_connect(c, NULL, PA_CONTEXT_NOFLAGS, NULL);
-    assert(c);
-
-    pa_threaded_mainloop_unlock(m);
+    pulse_ctx = pa_context_new(&pulse_api, "sstat_volmon");
+    assert(pulse_ctx);
+    pa_context_set_state_callback(pulse_ctx, pulse_context_state_cb, NULL);
+    pa_context_connect(pulse_ctx, NULL, PA_CONTEXT_NOFLAGS, NULL);
 #endif
 
-    /* main loop, 
-     * make sure to keep delay exactly one second */
-    struct timeval tv;
-    unsigned long utime = 0;
-    int status_len = snprintf(NULL, 0, STATUS_FORMAT, STATUS_CONTENT);
-    char status_str[++status_len];
+    /* main loop,
+     * sleep until the next entry is due or an event source fires,
+     * then resample only what is due */
+    struct epoll_event evs[16];
+    Watch *w;
+    int i, n;
+    unsigned long next;
+    char status_str[STATUS_MAX];
+    for (size_t i = 0; i < LEN(heap); i++) {
+        heap[i] = i;
+    }
+    tmpl_compile();
+    pool_init();
     while (!done) {
-        gettimeofday(&tv, NULL);
-        utime = 1000000 * tv.tv_sec + tv.tv_usec;
-
-        sprintf(status_str, STATUS_FORMAT, STATUS_CONTENT);
-        update_status(dest, status_str); 
-
-        gettimeofday(&tv, NULL);
-        utime = (1000000 * tv.tv_sec + tv.tv_usec) - utime;
+        cycle++;
+        schedule(now_ms());
+        pool_wait(now_ms() + ASYNC_WAIT);
+        /* nothing changed, don't wake up the window manager for it */
+        if (render(status_str, sizeof(status_str))) {
+            update_status(dest, status_str);
+        }
 
-        if (utime < 1000000) {
-            usleep(1000000 - utime);
+        next = MIN(slots[heap[0]].deadline, commands_deadline());
+#ifdef PULSE
+        next = MIN(next, pulse_deadline());
+#endif
+        timer_arm(next);
+        if ((n = epoll_wait(epfd, evs, LEN(evs), -1)) < 0) {
+            continue;
         }
+        for (i = 0; i < n; i++) {
+            w = evs[i].data.ptr;
+            w->cb(w, evs[i].events);
+        }
+        commands_check(now_ms());
+#ifdef PULSE
+        pulse_dispatch(now_ms());
+#endif
+    }
+
+    commands_kill();
+    if (prof_exit) {
+        prof_dump();
     }
 
     if (dest == XROOT) {
@@ -1164,9 +4887,12 @@ main(int argc, char *argv[])
 
 #ifdef PULSE
     /* cleanup pulse */
-    pa_context_unref(c);
-    pa_threaded_mainloop_stop(m);
-    pa_threaded_mainloop_free(m);
+    if (pulse_ctx) {
+        pa_context_disconnect(pulse_ctx);
+        pa_context_unref(pulse_ctx);
+        pulse_ctx = NULL;
+    }
+    pulse_dispatch(now_ms());
 #endif
 
     return 0;